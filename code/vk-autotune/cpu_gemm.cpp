@@ -0,0 +1,165 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 davidscarth
+ */
+
+#include "cpu_gemm.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CPU_GEMM_NEON 1
+#elif defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#define CPU_GEMM_AVX2 1
+#endif
+
+namespace {
+
+constexpr uint32_t MR = 4;   // microtile rows
+constexpr uint32_t NR = 16;  // microtile cols
+constexpr uint32_t KC = 256; // K block: an MR x KC strip of A stays in L1
+constexpr uint32_t NC = 512; // N block: the KC x NC panel of B stays in L2
+
+// C[MR x NR] (=|+=) A[MR x kc] * B[kc x NR]
+void micro_4x16(uint32_t kc, const float* A, uint32_t lda, const float* B, uint32_t ldb,
+                float* C, uint32_t ldc, bool first) {
+#if defined(CPU_GEMM_NEON)
+    float32x4_t c[MR][4];
+    for (uint32_t r=0;r<MR;r++) for (uint32_t j=0;j<4;j++) c[r][j] = vdupq_n_f32(0.0f);
+    for (uint32_t k=0;k<kc;k++) {
+        const float* b = B + (size_t)k*ldb;
+        float32x4_t b0 = vld1q_f32(b), b1 = vld1q_f32(b+4), b2 = vld1q_f32(b+8), b3 = vld1q_f32(b+12);
+        for (uint32_t r=0;r<MR;r++) {
+            float32x4_t a = vdupq_n_f32(A[(size_t)r*lda + k]);
+#if defined(__aarch64__)
+            c[r][0] = vfmaq_f32(c[r][0], a, b0); c[r][1] = vfmaq_f32(c[r][1], a, b1);
+            c[r][2] = vfmaq_f32(c[r][2], a, b2); c[r][3] = vfmaq_f32(c[r][3], a, b3);
+#else
+            c[r][0] = vmlaq_f32(c[r][0], a, b0); c[r][1] = vmlaq_f32(c[r][1], a, b1);
+            c[r][2] = vmlaq_f32(c[r][2], a, b2); c[r][3] = vmlaq_f32(c[r][3], a, b3);
+#endif
+        }
+    }
+    for (uint32_t r=0;r<MR;r++) {
+        float* cr = C + (size_t)r*ldc;
+        for (uint32_t j=0;j<4;j++) {
+            float32x4_t v = first ? c[r][j] : vaddq_f32(vld1q_f32(cr + 4*j), c[r][j]);
+            vst1q_f32(cr + 4*j, v);
+        }
+    }
+#elif defined(CPU_GEMM_AVX2)
+    __m256 c[MR][2];
+    for (uint32_t r=0;r<MR;r++) { c[r][0] = _mm256_setzero_ps(); c[r][1] = _mm256_setzero_ps(); }
+    for (uint32_t k=0;k<kc;k++) {
+        const float* b = B + (size_t)k*ldb;
+        __m256 b0 = _mm256_loadu_ps(b), b1 = _mm256_loadu_ps(b+8);
+        for (uint32_t r=0;r<MR;r++) {
+            __m256 a = _mm256_broadcast_ss(A + (size_t)r*lda + k);
+            c[r][0] = _mm256_fmadd_ps(a, b0, c[r][0]);
+            c[r][1] = _mm256_fmadd_ps(a, b1, c[r][1]);
+        }
+    }
+    for (uint32_t r=0;r<MR;r++) {
+        float* cr = C + (size_t)r*ldc;
+        for (uint32_t j=0;j<2;j++) {
+            __m256 v = first ? c[r][j] : _mm256_add_ps(_mm256_loadu_ps(cr + 8*j), c[r][j]);
+            _mm256_storeu_ps(cr + 8*j, v);
+        }
+    }
+#else
+    float c[MR][NR] = {};
+    for (uint32_t k=0;k<kc;k++) {
+        const float* b = B + (size_t)k*ldb;
+        for (uint32_t r=0;r<MR;r++) {
+            float a = A[(size_t)r*lda + k];
+            for (uint32_t j=0;j<NR;j++) c[r][j] += a * b[j];
+        }
+    }
+    for (uint32_t r=0;r<MR;r++) {
+        float* cr = C + (size_t)r*ldc;
+        for (uint32_t j=0;j<NR;j++) cr[j] = first ? c[r][j] : cr[j] + c[r][j];
+    }
+#endif
+}
+
+// Ragged edge (mr <= MR, nr <= NR)
+void micro_edge(uint32_t mr, uint32_t nr, uint32_t kc, const float* A, uint32_t lda,
+                const float* B, uint32_t ldb, float* C, uint32_t ldc, bool first) {
+    float c[MR][NR] = {};
+    for (uint32_t k=0;k<kc;k++) {
+        const float* b = B + (size_t)k*ldb;
+        for (uint32_t r=0;r<mr;r++) {
+            float a = A[(size_t)r*lda + k];
+            for (uint32_t j=0;j<nr;j++) c[r][j] += a * b[j];
+        }
+    }
+    for (uint32_t r=0;r<mr;r++) {
+        float* cr = C + (size_t)r*ldc;
+        for (uint32_t j=0;j<nr;j++) cr[j] = first ? c[r][j] : cr[j] + c[r][j];
+    }
+}
+
+// Rows [r0, r1) of C
+void sgemm_rows(uint32_t r0, uint32_t r1, uint32_t N, uint32_t K,
+                const float* A, uint32_t lda, const float* B, uint32_t ldb, float* C, uint32_t ldc) {
+    if (K == 0) {
+        for (uint32_t i=r0;i<r1;i++) std::fill_n(C + (size_t)i*ldc, N, 0.0f);
+        return;
+    }
+    for (uint32_t jc=0; jc<N; jc+=NC) {
+        uint32_t nc = std::min(NC, N - jc);
+        for (uint32_t pc=0; pc<K; pc+=KC) {
+            uint32_t kc = std::min(KC, K - pc);
+            bool first = pc == 0;
+            for (uint32_t i=r0; i<r1; i+=MR) {
+                uint32_t mr = std::min(MR, r1 - i);
+                const float* Ai = A + (size_t)i*lda + pc;
+                for (uint32_t j=jc; j<jc+nc; j+=NR) {
+                    uint32_t nr = std::min(NR, jc + nc - j);
+                    const float* Bj = B + (size_t)pc*ldb + j;
+                    float* Cij = C + (size_t)i*ldc + j;
+                    if (mr == MR && nr == NR) micro_4x16(kc, Ai, lda, Bj, ldb, Cij, ldc, first);
+                    else micro_edge(mr, nr, kc, Ai, lda, Bj, ldb, Cij, ldc, first);
+                }
+            }
+        }
+    }
+}
+
+} // namespace
+
+void cpu_sgemm(uint32_t M, uint32_t N, uint32_t K,
+               const float* A, uint32_t lda,
+               const float* B, uint32_t ldb,
+               float* C, uint32_t ldc,
+               uint32_t nthreads) {
+    if (!M || !N) return;
+    if (!nthreads) nthreads = std::max(1u, std::thread::hardware_concurrency());
+    // MR-aligned row slabs, one per thread
+    uint32_t strips = (M + MR - 1) / MR;
+    nthreads = std::min(nthreads, strips);
+    uint32_t rows_per = ((strips + nthreads - 1) / nthreads) * MR;
+
+    std::vector<std::thread> pool;
+    for (uint32_t t=1; t<nthreads; t++) {
+        uint32_t r0 = t * rows_per, r1 = std::min(M, r0 + rows_per);
+        if (r0 >= r1) break;
+        pool.emplace_back(sgemm_rows, r0, r1, N, K, A, lda, B, ldb, C, ldc);
+    }
+    sgemm_rows(0, std::min(M, rows_per), N, K, A, lda, B, ldb, C, ldc);
+    for (auto& th : pool) th.join();
+}
+
+const char* cpu_sgemm_isa() {
+#if defined(CPU_GEMM_NEON)
+    return "neon";
+#elif defined(CPU_GEMM_AVX2)
+    return "avx2+fma";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,18 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 davidscarth
+ */
+#pragma once
+
+#include <cstdint>
+
+// C[MxN] = A[MxK] * B[KxN], row-major FP32, leading dimensions in floats.
+// Cache-blocked over K/N, register-blocked 4xNR microkernel (NEON / AVX2+FMA /
+// plain C++), rows split across `nthreads` std::threads (0 = all cores).
+void cpu_sgemm(uint32_t M, uint32_t N, uint32_t K,
+               const float* A, uint32_t lda,
+               const float* B, uint32_t ldb,
+               float* C, uint32_t ldc,
+               uint32_t nthreads = 0);
+
+// SIMD path compiled in: "neon", "avx2+fma" or "scalar"
+const char* cpu_sgemm_isa();
@@ -14,168 +14,76 @@
 #include <algorithm>
 #include <cmath>
 #include <fstream>
+#include <iterator>
 #include <iostream>
+#include <unordered_map>
+#include <ctime>
+#include <unistd.h>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <random>
+#include <limits>
+#include <cctype>
+#include <functional>
+#include <memory>
+#include <map>
+
+#include "cpu_gemm.h"
+#include "quant.h"
+#include "thermal.h"
+#include "vk_common.h"
+#include "vk_gemm.h"
+#include "winners.h"
+
+// The shared context plus what only the tuner needs: timestamps and the
+// buffers the candidates are measured on
+struct TuneCtx : VulkanCtx {
+    VkQueryPool qpool = VK_NULL_HANDLE;     // a timestamp pair per dispatch of a chunk
+    MemArena arena;                         // A, B, C (+ W)
+    GpuBuf bufA, bufB, bufC;
+    GpuBuf bufW;                            // split-K partial sums, S x M x N (only with --splitk > 1)
+    GpuBuf bufBias;                         // epilogue per-column bias (binding 3 of every GEMM set)
+    GpuBuf bufT;                            // unfused epilogue: GEMM result before the elementwise pass
+    GpuBuf bufP;                            // --packb: B in the pack_b() layout of the candidate being run
+};
 
-#ifndef VK_AT_COMPILE_TOOL
-#define VK_AT_COMPILE_TOOL "unknown"
-#endif
+// --epilogue= / AT_EPILOGUE
+static uint32_t epilogue_arg(const char* s) {
+    uint32_t e = 0;
+    if (!parse_epilogue(s, &e)) { fprintf(stderr, "Bad --epilogue=%s (none | scale+bias+relu|silu|gelu, one activation)\n", s); std::exit(1); }
+    return e;
+}
 
-#define VK_CHECK(x) do { VkResult err = (x); if (err) { fprintf(stderr,"Vulkan error %d at %s:%d\n", err, __FILE__, __LINE__); std::exit(1);} } while(0)
+// CPU reference of epilogue.glsl for --verify
+static float epilogue_ref(uint32_t e, float acc, float c_old, float bias, float alpha, float beta) {
+    float v = (e & EPI_SCALE) ? alpha * acc + beta * c_old : acc;
+    if (e & EPI_BIAS) v += bias;
+    switch (e & EPI_ACT_MASK) {
+    case EPI_RELU: v = std::max(v, 0.0f); break;
+    case EPI_SILU: v = v / (1.0f + std::exp(-v)); break;
+    case EPI_GELU: v = 0.5f * v * (1.0f + std::tanh(0.7978845608f * (v + 0.044715f * v * v * v))); break;
+    }
+    return v;
+}
 
-static std::vector<uint32_t> load_spirv(const char* path) {
-    FILE* f = fopen(path, "rb");
-    if (!f) { perror("fopen gemm.spv"); std::exit(1); }
-    fseek(f,0,SEEK_END); long sz = ftell(f); fseek(f,0,SEEK_SET);
-    std::vector<uint32_t> buf((sz+3)/4);
-    size_t rd = fread(buf.data(),1,sz,f); (void)rd; fclose(f);
+static std::string cand_str(const Cand& g) {
+    char buf[128];
+    int n = snprintf(buf, sizeof(buf), "TM=%u TN=%u TK=%u lsz=(%u,%u) smem=%u", g.TM,g.TN,g.TK,g.lszx,g.lszy,g.smem);
+    if (g.fam == 1) n += snprintf(buf + n, sizeof(buf) - n, " v2 vec=%u dbuf=%u pad=%u", g.vec, g.dbuf, g.pad);
+    if (g.splitk > 1) n += snprintf(buf + n, sizeof(buf) - n, " splitk=%u", g.splitk);
+    if (g.epi) n += snprintf(buf + n, sizeof(buf) - n, " %s", g.fused ? "fused" : "unfused");
+    if (g.cpu) n += snprintf(buf + n, sizeof(buf) - n, " cpu=%u%%", g.cpu);
+    if (g.packb) snprintf(buf + n, sizeof(buf) - n, " packb");
     return buf;
 }
 
-static uint32_t ceil_div(uint32_t a, uint32_t b){ return (a + b - 1u)/b; }
-
-struct VulkanCtx {
-    VkInstance instance = VK_NULL_HANDLE;
-    VkPhysicalDevice pdev = VK_NULL_HANDLE;
-    VkDevice device = VK_NULL_HANDLE;
-    uint32_t qfam = 0;
-    VkQueue queue = VK_NULL_HANDLE;
-    VkPhysicalDeviceProperties props{};
-    VkPhysicalDeviceSubgroupProperties subprops{};
-    VkCommandPool cpool = VK_NULL_HANDLE;
-    VkDescriptorSetLayout dsl = VK_NULL_HANDLE;
-    VkPipelineLayout ppl = VK_NULL_HANDLE;
-    VkDescriptorPool dpool = VK_NULL_HANDLE;
-    VkQueryPool qpool = VK_NULL_HANDLE;
-    VkBuffer bufA = VK_NULL_HANDLE, bufB = VK_NULL_HANDLE, bufC = VK_NULL_HANDLE;
-    VkDeviceMemory memA = VK_NULL_HANDLE, memB = VK_NULL_HANDLE, memC = VK_NULL_HANDLE;
-    double timestamp_period_ns = 1.0;
-};
-
-static void create_buffer(VulkanCtx& C, VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buf, VkDeviceMemory& mem) {
-    VkBufferCreateInfo bi{VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
-    bi.size = size;
-    bi.usage = usage;
-    bi.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    VK_CHECK(vkCreateBuffer(C.device, &bi, nullptr, &buf));
-
-    VkMemoryRequirements mr; vkGetBufferMemoryRequirements(C.device, buf, &mr);
-
-    VkPhysicalDeviceMemoryProperties mp;
-    vkGetPhysicalDeviceMemoryProperties(C.pdev, &mp);
-    uint32_t idx = UINT32_MAX;
-    for (uint32_t i=0;i<mp.memoryTypeCount;i++){
-        if ((mr.memoryTypeBits & (1u<<i)) && (mp.memoryTypes[i].propertyFlags & (VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))==(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) { idx=i; break; }
-    }
-    if (idx==UINT32_MAX) { fprintf(stderr,"No HOST_VISIBLE|HOST_COHERENT memory found\n"); std::exit(1); }
-
-    VkMemoryAllocateInfo ai{VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
-    ai.allocationSize = mr.size;
-    ai.memoryTypeIndex = idx;
-    VK_CHECK(vkAllocateMemory(C.device, &ai, nullptr, &mem));
-    VK_CHECK(vkBindBufferMemory(C.device, buf, mem, 0));
-}
-
-static bool contains_str(const char* s, const char* needle){
-    return s && needle && std::strstr(s, needle);
-}
-
-static void init_vulkan(VulkanCtx& C) {
-    // Instance
-    VkApplicationInfo ai{VK_STRUCTURE_TYPE_APPLICATION_INFO};
-    ai.pApplicationName = "vk-autotune";
-    ai.apiVersion = VK_API_VERSION_1_3;
-
-    VkInstanceCreateInfo ici{VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO};
-    ici.pApplicationInfo = &ai;
-    VK_CHECK(vkCreateInstance(&ici, nullptr, &C.instance));
-
-    // Pick compute queue physical device (avoid software stacks)
-    uint32_t ndev=0; VK_CHECK(vkEnumeratePhysicalDevices(C.instance, &ndev, nullptr));
-    std::vector<VkPhysicalDevice> devs(ndev); VK_CHECK(vkEnumeratePhysicalDevices(C.instance, &ndev, devs.data()));
-
-    for (auto d : devs) {
-        VkPhysicalDeviceProperties p{}; vkGetPhysicalDeviceProperties(d, &p);
-        uint32_t qf=0; vkGetPhysicalDeviceQueueFamilyProperties(d, &qf, nullptr);
-        std::vector<VkQueueFamilyProperties> qfp(qf); vkGetPhysicalDeviceQueueFamilyProperties(d, &qf, qfp.data());
-        int computeFam = -1;
-        for (uint32_t i=0;i<qf;i++) if (qfp[i].queueFlags & VK_QUEUE_COMPUTE_BIT) { computeFam = (int)i; break; }
-        if (computeFam<0) continue;
-        if (contains_str(p.deviceName, "llvmpipe") || contains_str(p.deviceName, "lavapipe") || contains_str(p.deviceName, "software")) continue;
-        C.pdev = d; C.qfam = (uint32_t)computeFam; C.props = p; break;
-    }
-    if (!C.pdev) { // fallback
-        C.pdev = devs[0];
-        vkGetPhysicalDeviceProperties(C.pdev, &C.props);
-        uint32_t qf=0; vkGetPhysicalDeviceQueueFamilyProperties(C.pdev, &qf, nullptr);
-        std::vector<VkQueueFamilyProperties> qfp(qf); vkGetPhysicalDeviceQueueFamilyProperties(C.pdev, &qf, qfp.data());
-        for (uint32_t i=0;i<qf;i++) if (qfp[i].queueFlags & VK_QUEUE_COMPUTE_BIT) { C.qfam = i; break; }
-    }
-
-    // Subgroup props
-    C.subprops = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES };
-    VkPhysicalDeviceProperties2 p2{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
-    p2.pNext = &C.subprops;
-    vkGetPhysicalDeviceProperties2(C.pdev, &p2);
-
-    // Device
-    float prio = 1.0f;
-    VkDeviceQueueCreateInfo qci{VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO};
-    qci.queueFamilyIndex = C.qfam;
-    qci.queueCount = 1; qci.pQueuePriorities = &prio;
-    VkDeviceCreateInfo dci{VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO};
-    dci.queueCreateInfoCount = 1; dci.pQueueCreateInfos = &qci;
-    VK_CHECK(vkCreateDevice(C.pdev, &dci, nullptr, &C.device));
-    vkGetDeviceQueue(C.device, C.qfam, 0, &C.queue);
-
-    // Command pool
-    VkCommandPoolCreateInfo pci{VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
-    pci.queueFamilyIndex = C.qfam;
-    VK_CHECK(vkCreateCommandPool(C.device, &pci, nullptr, &C.cpool));
-
-    // Descriptor set layout (A,B,C)
-    VkDescriptorSetLayoutBinding b[3] = {};
-    for (int i=0;i<3;i++){ b[i].binding = i; b[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; b[i].descriptorCount=1; b[i].stageFlags=VK_SHADER_STAGE_COMPUTE_BIT; }
-    VkDescriptorSetLayoutCreateInfo dlci{VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
-    dlci.bindingCount = 3; dlci.pBindings = b;
-    VK_CHECK(vkCreateDescriptorSetLayout(C.device, &dlci, nullptr, &C.dsl));
-
-    // Pipeline layout (push constants)
-    VkPushConstantRange pcr{}; pcr.offset=0; pcr.size=6*sizeof(uint32_t); pcr.stageFlags=VK_SHADER_STAGE_COMPUTE_BIT;
-    VkPipelineLayoutCreateInfo plci{VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
-    plci.setLayoutCount = 1; plci.pSetLayouts = &C.dsl;
-    plci.pushConstantRangeCount = 1; plci.pPushConstantRanges = &pcr;
-    VK_CHECK(vkCreatePipelineLayout(C.device, &plci, nullptr, &C.ppl));
-
-    // Descriptor pool
-    VkDescriptorPoolSize dps{}; dps.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; dps.descriptorCount = 3;
-    VkDescriptorPoolCreateInfo dpci{VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
-    dpci.maxSets = 1; dpci.poolSizeCount = 1; dpci.pPoolSizes = &dps;
-    VK_CHECK(vkCreateDescriptorPool(C.device, &dpci, nullptr, &C.dpool));
-
-    // Query pool (timestamps)
-    VkQueryPoolCreateInfo qpci{VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
-    qpci.queryType = VK_QUERY_TYPE_TIMESTAMP; qpci.queryCount = 2;
-    VK_CHECK(vkCreateQueryPool(C.device, &qpci, nullptr, &C.qpool));
-
-    C.timestamp_period_ns = C.props.limits.timestampPeriod ? C.props.limits.timestampPeriod : 1.0;
-
-    // Banner
-    fprintf(stderr,
-        "# Device: %s (API %u.%u)  driver=%u\n"
-        "# maxWGInvocations=%u, maxSharedMemPerWG=%u bytes, subgroupSize=%u\n"
-        "# shader-compiler=%s\n",
-        C.props.deviceName,
-        VK_VERSION_MAJOR(C.props.apiVersion), VK_VERSION_MINOR(C.props.apiVersion),
-        C.props.driverVersion,
-        C.props.limits.maxComputeWorkGroupInvocations,
-        C.props.limits.maxComputeSharedMemorySize,
-        C.subprops.subgroupSize,
-        VK_AT_COMPILE_TOOL
-    );
+// CSV / winners column: "bias+silu:fused", "none" without an epilogue
+static std::string epilogue_col(const Cand& g) {
+    return g.epi ? epilogue_name(g.epi) + (g.fused ? ":fused" : ":unfused") : "none";
 }
 
-struct Cand { uint32_t TM,TN,TK, lszx, lszy, smem; };
-
 static std::vector<std::pair<uint32_t,uint32_t>> parse_lsz(const char* s) {
     if (!s || !*s) return {{16,8},{16,4},{16,1}};
     std::vector<std::pair<uint32_t,uint32_t>> out; uint32_t a=0,b=0; bool ia=false,ib=false,ix=false;
@@ -208,6 +116,17 @@ static std::vector<uint32_t> parse_u32_list(const char* s, const std::vector<uin
     return out;
 }
 
+// "a,b,c" -> {"a","b","c"}; empty items are dropped
+static std::vector<std::string> split_list(const std::string& s) {
+    std::vector<std::string> out; size_t pos = 0;
+    while (pos <= s.size()) {
+        size_t e = s.find(',', pos); if (e == std::string::npos) e = s.size();
+        if (e > pos) out.push_back(s.substr(pos, e - pos));
+        pos = e + 1;
+    }
+    return out;
+}
+
 static void add_tile(std::vector<Cand>& G, uint32_t TM, uint32_t TN, uint32_t TK,
                      const std::vector<std::pair<uint32_t,uint32_t>>& LSZ, bool smem,
                      uint32_t maxWGInv, uint32_t maxSMEM,
@@ -226,11 +145,12 @@ static void add_tile(std::vector<Cand>& G, uint32_t TM, uint32_t TN, uint32_t TK
     }
 }
 
+// epi/fuse: the run's epilogue and which of fused|unfused|both to measure
 static std::vector<Cand> build_grid(const VkPhysicalDeviceProperties& props, uint32_t subgroup,
-                                    int argc, char** argv) {
+                                    uint32_t epi, const std::string& fuse, int argc, char** argv) {
     std::vector<Cand> grid;
     // defaults
-    std::string preset = "classic"; // classic | classic_legacy | extended16k | extended16k_capped
+    std::string preset = "classic"; // classic | classic_legacy | extended16k | extended16k_capped | wide
     std::vector<std::pair<uint32_t,uint32_t>> LSZ;
     std::vector<uint32_t> Ms = {64,80,96,112};
     std::vector<uint32_t> Ns = {32,48,64,80};
@@ -238,6 +158,12 @@ static std::vector<Cand> build_grid(const VkPhysicalDeviceProperties& props, uin
     int  max_rn = -1;
     int  max_rm = -1;
     std::vector<std::pair<uint32_t,uint32_t>> add_pairs;
+    std::string families = "v1";            // v1 = gemm.comp, v2 = gemm_v2.comp
+    std::vector<uint32_t> vecs = {4}, dbufs = {0,1}, pads = {0,1};
+    std::vector<uint32_t> splitks = {1};
+    std::vector<uint32_t> cpus = {0};       // hybrid: percent of M rows on the CPU
+    std::vector<uint32_t> packbs = {0};     // 1 = B pre-packed into tile panels
+    std::vector<uint32_t> tks;              // TK values (empty = subgroup size)
 
     // parse argv
     for (int i=1;i<argc;i++){
@@ -250,6 +176,14 @@ static std::vector<Cand> build_grid(const VkPhysicalDeviceProperties& props, uin
         else if (!strncmp(a,"--enable-nosmem=",16))  enable_nosmem = atoi(a+16)!=0;
         else if (!strncmp(a,"--max-rn=",9))          max_rn = atoi(a+9);
         else if (!strncmp(a,"--max-rm=",9))          max_rm = atoi(a+9);
+        else if (!strncmp(a,"--family=",9))          families = a+9;
+        else if (!strncmp(a,"--vec=",6))             vecs  = parse_u32_list(a+6, vecs);
+        else if (!strncmp(a,"--dbuf=",7))            dbufs = parse_u32_list(a+7, dbufs);
+        else if (!strncmp(a,"--pad=",6))             pads  = parse_u32_list(a+6, pads);
+        else if (!strncmp(a,"--splitk=",9))          splitks = parse_u32_list(a+9, splitks);
+        else if (!strncmp(a,"--cpu-split=",12))      cpus = parse_u32_list(a+12, cpus);
+        else if (!strncmp(a,"--packb=",8))           packbs = parse_u32_list(a+8, packbs);
+        else if (!strncmp(a,"--tk=",5))              tks = parse_u32_list(a+5, tks);
         else if (!strncmp(a,"--add-tiles=",12)) {
             const char* s = a+12; uint32_t tm=0,tn=0; bool got_tm=false;
             for (const char* p=s;;++p){ char c=*p;
@@ -268,6 +202,20 @@ static std::vector<Cand> build_grid(const VkPhysicalDeviceProperties& props, uin
     if (const char* e=getenv("AT_ENABLE_NOSMEM")) enable_nosmem = atoi(e)!=0;
     if (const char* e=getenv("AT_MAX_RN"))        max_rn        = atoi(e);
     if (const char* e=getenv("AT_MAX_RM"))        max_rm        = atoi(e);
+    if (const char* e=getenv("AT_FAMILY"))        families      = e;
+    if (const char* e=getenv("AT_VEC"))           vecs          = parse_u32_list(e, vecs);
+    if (const char* e=getenv("AT_DBUF"))          dbufs         = parse_u32_list(e, dbufs);
+    if (const char* e=getenv("AT_PAD"))           pads          = parse_u32_list(e, pads);
+    if (const char* e=getenv("AT_SPLITK"))        splitks       = parse_u32_list(e, splitks);
+    if (const char* e=getenv("AT_CPU_SPLIT"))     cpus          = parse_u32_list(e, cpus);
+    if (const char* e=getenv("AT_PACKB"))         packbs        = parse_u32_list(e, packbs);
+    if (const char* e=getenv("AT_TK"))            tks           = parse_u32_list(e, tks);
+    bool fam_v1 = false, fam_v2 = false;
+    for (const auto& f : split_list(families)) {
+        if (f == "v1") fam_v1 = true;
+        else if (f == "v2") fam_v2 = true;
+        else { fprintf(stderr, "Unknown --family=%s (v1|v2)\n", f.c_str()); std::exit(1); }
+    }
 
     // default lanes per preset (if not specified)
     if (LSZ.empty()) {
@@ -278,9 +226,12 @@ static std::vector<Cand> build_grid(const VkPhysicalDeviceProperties& props, uin
         else LSZ = {{16,8},{16,4},{16,1}};
     }
 
-    // Default per-thread microtile caps to 8x8 unless user overrides
-    if (max_rn <= 0) max_rn = 8;
-    if (max_rm <= 0) max_rm = 8;
+    // Default per-thread microtile caps: 8x8 for gemm.comp's fixed acc[8][8];
+    // gemm_v2 sizes its register tile from spec constants, so it may go to 16x16
+    const int v1_rn = max_rn > 0 ? std::min(max_rn, 8) : 8, v1_rm = max_rm > 0 ? std::min(max_rm, 8) : 8;
+    const int v2_rn = max_rn > 0 ? max_rn : 16,             v2_rm = max_rm > 0 ? max_rm : 16;
+    max_rn = fam_v2 ? std::max(v1_rn, v2_rn) : v1_rn;
+    max_rm = fam_v2 ? std::max(v1_rm, v2_rm) : v1_rm;
 
     uint32_t TK = subgroup;
     uint32_t maxWGInv = props.limits.maxComputeWorkGroupInvocations;
@@ -296,7 +247,7 @@ static std::vector<Cand> build_grid(const VkPhysicalDeviceProperties& props, uin
         }
     };
     auto add_baselines = [&](){
-        if (!enable_nosmem) return;
+        if (!enable_nosmem || !fam_v1) return;
         add_tile(grid, 32,32,TK, LSZ, /*smem=*/false, maxWGInv, maxSMEM, maxWGSizeX, maxWGSizeY, max_rn, max_rm);
     };
 
@@ -332,6 +283,17 @@ static std::vector<Cand> build_grid(const VkPhysicalDeviceProperties& props, uin
             }
         }
         add_baselines();
+    } else if (preset=="wide") {
+        // Every TM x TN that is a whole multiple of the lane shape, up to the
+        // register caps; meant for --search=model
+        if (enable_smem)
+            for (auto [x,y] : LSZ)
+                for (int rm=1; rm<=max_rm; rm++) for (int rn=1; rn<=max_rn; rn++) {
+                    uint32_t TM = y * rm, TN = x * rn;
+                    if (4ull*TK*(TM + TN) > maxSMEM) continue;
+                    add_tile(grid, TM,TN,TK, {{x,y}}, true, maxWGInv, maxSMEM, maxWGSizeX, maxWGSizeY, max_rn, max_rm);
+                }
+        add_baselines();
     }
 
     if (!add_pairs.empty()) {
@@ -341,235 +303,2855 @@ static std::vector<Cand> build_grid(const VkPhysicalDeviceProperties& props, uin
         }
     }
 
+    // TK is the subgroup size unless --tk= lists others; every tile gets each
+    if (!tks.empty()) {
+        std::vector<Cand> base; base.swap(grid);
+        for (const Cand& b : base)
+            for (uint32_t tk : tks) {
+                if (!tk || (b.smem && 4ull*tk*(b.TM + b.TN) > maxSMEM)) continue;
+                Cand g = b; g.TK = tk; grid.push_back(g);
+            }
+    }
+
+    // Split the tiles into families: v1 keeps the 8x8 cap, v2 fans out over
+    // vec/dbuf/pad and is re-checked against SMEM with its own footprint
+    {
+        std::vector<Cand> base; base.swap(grid);
+        for (const Cand& b : base) {
+            uint32_t RN = (b.TN + b.lszx - 1) / b.lszx, RM = (b.TM + b.lszy - 1) / b.lszy;
+            if (fam_v1 && (int)RN <= v1_rn && (int)RM <= v1_rm) grid.push_back(b);
+            if (!fam_v2 || !b.smem || (int)RN > v2_rn || (int)RM > v2_rm) continue;
+            for (uint32_t vec : vecs) for (uint32_t db : dbufs) for (uint32_t pad : pads) {
+                if (vec != 1 && vec != 4) continue;
+                if (vec == 4 && (b.TK % 4 || b.TN % 4)) continue;
+                Cand g = b; g.fam = 1; g.vec = vec; g.dbuf = db ? 1 : 0; g.pad = pad;
+                if (smem_bytes(g) > maxSMEM) continue;
+                grid.push_back(g);
+            }
+        }
+    }
+
+    // Split-K factors, epilogue fusion, the CPU share and packed B are
+    // independent of the tile, every candidate gets each one. 100% would not
+    // use the tile.
+    {
+        std::vector<Cand> base; base.swap(grid);
+        for (const Cand& b : base)
+            for (uint32_t s : splitks) for (uint32_t c : cpus) for (uint32_t pb : packbs) {
+                if (!s || c > 99 || pb > 1) continue;
+                Cand g = b; g.splitk = s; g.epi = epi; g.cpu = c; g.packb = pb;
+                if (!epi || fuse != "unfused") { g.fused = 1; grid.push_back(g); }
+                if (epi && fuse != "fused")    { g.fused = 0; grid.push_back(g); }
+            }
+    }
+
     std::sort(grid.begin(), grid.end(), [](const Cand&a,const Cand&b){
+        if (a.fam!=b.fam) return a.fam<b.fam;
         if (a.smem!=b.smem) return a.smem>b.smem;
         if (a.TM!=b.TM) return a.TM<b.TM;
         if (a.TN!=b.TN) return a.TN<b.TN;
         if (a.TK!=b.TK) return a.TK<b.TK;
         if (a.lszx!=b.lszx) return a.lszx<b.lszx;
-        return a.lszy<b.lszy;
+        if (a.lszy!=b.lszy) return a.lszy<b.lszy;
+        if (a.vec!=b.vec) return a.vec<b.vec;
+        if (a.dbuf!=b.dbuf) return a.dbuf<b.dbuf;
+        if (a.pad!=b.pad) return a.pad<b.pad;
+        if (a.splitk!=b.splitk) return a.splitk<b.splitk;
+        if (a.fused!=b.fused) return a.fused>b.fused;
+        if (a.cpu!=b.cpu) return a.cpu<b.cpu;
+        return a.packb<b.packb;
     });
     grid.erase(std::unique(grid.begin(), grid.end(), [](const Cand&a,const Cand&b){
         return a.TM==b.TM && a.TN==b.TN && a.TK==b.TK &&
-               a.lszx==b.lszx && a.lszy==b.lszy && a.smem==b.smem;
+               a.lszx==b.lszx && a.lszy==b.lszy && a.smem==b.smem &&
+               a.fam==b.fam && a.vec==b.vec && a.dbuf==b.dbuf && a.pad==b.pad && a.splitk==b.splitk &&
+               a.fused==b.fused && a.cpu==b.cpu && a.packb==b.packb;
     }), grid.end());
 
     fprintf(stderr, "# Preset=%s  lanes=", preset.c_str());
     for (size_t i=0;i<LSZ.size();++i){ fprintf(stderr, "%ux%u%s", LSZ[i].first, LSZ[i].second, (i+1<LSZ.size())?",":""); }
-    fprintf(stderr, "  candidates=%zu\n", grid.size());
+    fprintf(stderr, "  families=%s  epilogue=%s%s  candidates=%zu\n", families.c_str(), epilogue_name(epi).c_str(),
+            epi ? (" (" + fuse + ")").c_str() : "", grid.size());
     return grid;
 }
 
 struct RunCfg {
     uint32_t M=1024, N=1024, K=1024;
+    uint32_t BATCH=1;                  // independent M x N x K products per dispatch (strided batched GEMM)
     uint32_t WARM=5, REP=30;
     uint64_t TIMEOUT_MS=600000; // per-candidate
     double   SMEM_FRAC=1.0;
     const char* CSV=nullptr;
+    std::string DB="autotune_db.tsv"; // persistent results; empty disables
+    bool     RESUME=true;              // skip candidates with a valid DB record
+    std::string PIPELINE_CACHE="pipeline_cache.bin"; // VkPipelineCache blob; empty disables
+    bool     PRECOMPILE=true;          // build all pipelines up front
+    uint32_t COMPILE_THREADS=0;        // 0 = hardware_concurrency
+    uint32_t COMPILE_AHEAD=2;          // --precompile=0: pipelines built ahead of the measurement loop
+    std::string SEARCH="exhaustive";   // exhaustive | halving | model
+    uint32_t PROBE_REP=0;              // halving: reps of the first round (0 = REP/8)
+    uint32_t ETA=2;                    // halving: keep 1/ETA per round, reps *= ETA
+    double   PRUNE_FACTOR=1.5;         // halving: drop anything slower than this x leader
+    double   MODEL_BUDGET_S=60.0;      // model: measurement + compile time per shape
+    uint32_t MODEL_BATCH=8;            // model: candidates measured per round
+    uint32_t MODEL_INIT=12;            // model: random candidates measured before the first fit
+    uint32_t CHUNK=0;                  // dispatches per command buffer (0 = auto from SLICE_MS)
+    uint64_t SLICE_MS=250;             // auto chunking: target GPU time per command buffer
+    uint64_t BUDGET_MS=0;              // abort a candidate once its projected cost exceeds this (0 = TIMEOUT_MS)
+    double   CV_MAX=0.05;              // re-run when stddev/mean of per-dispatch times is above this
+    uint32_t CV_RETRIES=2;
+    double   OUTLIER_K=5.0;            // drop samples > K robust sigmas from the median (0 = keep all)
+    bool     VERIFY=false;             // random A/B, check C against the CPU reference
+    uint32_t SEED=1;
+    double   VERIFY_RTOL=1e-4;
+    double   VERIFY_ATOL=0.0;          // 0 = 1e-6 * K
+    uint32_t VERIFY_ULP=64;            // elements within this many ULPs always pass
+    uint32_t CPU_THREADS=0;            // CPU reference GEMM threads (0 = all cores)
+    std::string SHAPES;                // MxNxK list or @file; empty = the single AT_M/N/K shape
+    std::string WINNERS;               // per-shape winner table (TSV); empty = stdout only
+    std::string KERNEL="gemm";         // gemm (shaders/gemm.comp) | lowsmem | gemv | gemm_ls | kernel names
+    std::string QTYPE="f32,q4_0,q8_0,q4_k,q6_k"; // low-SMEM weight formats
+    MemPlace MEM=MemPlace::Coherent;   // where A/B/C (and the low-SMEM buffers) live
+    uint32_t EPILOGUE=0;               // EPI_* mask applied to C (0 = C = A*B)
+    float    ALPHA=1.0f, BETA=1.0f;    // EPI_SCALE: C = alpha*A*B + beta*C
+    std::string FUSE="both";           // fused | unfused | both: epilogue in the GEMM vs a separate pass
+    uint32_t BANDWIDTH_MIB=64;         // bandwidth kernel buffer size (0 = skip, no roofline)
+    double   PEAK_GFLOPS=0.0;          // compute roof (0 = memory roof only)
+    uint32_t PANEL_MIB=0;              // out of core: A/B/C over this many MiB run in panels of at most it (0 = over maxStorageBufferRange, 256 MiB panels)
+    double   TEMP_MAX=80.0;            // cool down before / re-measure after a run at or above this SoC temperature, C (0 = off)
+    uint32_t COOLDOWN_S=120;           // longest wait for the SoC to cool to TEMP_MAX-5 (0 = never wait)
+    uint32_t THROTTLE_RETRIES=1;       // re-measurements of a throttled candidate
+    std::string ORDER="shuffle";       // grid | shuffle: candidate order within a shape
+    std::string HWMON;                 // hwmon directory for power; empty = first with a sensor, "none" = off
+    uint32_t PACK_CALLS=1000;          // --packb: GEMM calls one packing of the weights is amortized over
+    uint32_t LATENCY=0;                // decode steps timed end to end per submission style (0 = no latency mode)
+    uint32_t LAYERS=22;                // latency: layers per token; a step runs the shapes of one token count this many times
+    std::string STREAMS;               // throughput mode: concurrent stream counts, e.g. "1,2,4" (empty = off)
+    uint32_t STREAM_TOP=3;             // throughput: fastest candidates of each shape run on the streams
+    std::string RANK="latency";        // latency | throughput: what picks a shape's winner
+    bool     WALL=false;               // set when the grid has hybrid candidates: time all by host wall clock
+    std::string MEM_USED;              // set with the arena: "device@0:DL", the placement and type actually allocated
 };
 
-static RunCfg env_runcfg() {
+static MemPlace parse_mem_place(const char* s) {
+    for (MemPlace p : {MemPlace::Coherent, MemPlace::Cached, MemPlace::Device})
+        if (!strcmp(s, mem_place_name(p))) return p;
+    fprintf(stderr, "Unknown --mem=%s (coherent|cached|device)\n", s);
+    std::exit(1);
+}
+
+static RunCfg env_runcfg(int argc, char** argv) {
     RunCfg r;
+    for (int i=1;i<argc;i++){
+        const char* a = argv[i];
+        if (!strncmp(a,"--db=",5))          r.DB = a+5;
+        else if (!strncmp(a,"--resume=",9)) r.RESUME = atoi(a+9)!=0;
+        else if (!strncmp(a,"--pipeline-cache=",17)) r.PIPELINE_CACHE = a+17;
+        else if (!strncmp(a,"--precompile=",13))     r.PRECOMPILE = atoi(a+13)!=0;
+        else if (!strncmp(a,"--compile-threads=",18)) r.COMPILE_THREADS = atoi(a+18);
+        else if (!strncmp(a,"--compile-ahead=",16)) r.COMPILE_AHEAD = atoi(a+16);
+        else if (!strncmp(a,"--search=",9))       r.SEARCH = a+9;
+        else if (!strncmp(a,"--probe-rep=",12))   r.PROBE_REP = atoi(a+12);
+        else if (!strncmp(a,"--eta=",6))          r.ETA = atoi(a+6);
+        else if (!strncmp(a,"--model-budget-s=",17)) r.MODEL_BUDGET_S = atof(a+17);
+        else if (!strncmp(a,"--model-batch=",14)) r.MODEL_BATCH = atoi(a+14);
+        else if (!strncmp(a,"--model-init=",13))  r.MODEL_INIT = atoi(a+13);
+        else if (!strncmp(a,"--prune-factor=",15)) r.PRUNE_FACTOR = atof(a+15);
+        else if (!strncmp(a,"--chunk=",8))        r.CHUNK = atoi(a+8);
+        else if (!strncmp(a,"--slice-ms=",11))    r.SLICE_MS = strtoull(a+11,nullptr,10);
+        else if (!strncmp(a,"--budget-ms=",12))   r.BUDGET_MS = strtoull(a+12,nullptr,10);
+        else if (!strncmp(a,"--cv-max=",9))       r.CV_MAX = atof(a+9);
+        else if (!strncmp(a,"--cv-retries=",13))  r.CV_RETRIES = atoi(a+13);
+        else if (!strncmp(a,"--outlier-k=",12))   r.OUTLIER_K = atof(a+12);
+        else if (!strcmp(a,"--verify"))           r.VERIFY = true;
+        else if (!strncmp(a,"--verify=",9))       r.VERIFY = atoi(a+9)!=0;
+        else if (!strncmp(a,"--seed=",7))         r.SEED = strtoul(a+7,nullptr,10);
+        else if (!strncmp(a,"--verify-rtol=",14)) r.VERIFY_RTOL = atof(a+14);
+        else if (!strncmp(a,"--verify-atol=",14)) r.VERIFY_ATOL = atof(a+14);
+        else if (!strncmp(a,"--verify-ulp=",13))  r.VERIFY_ULP = atoi(a+13);
+        else if (!strncmp(a,"--cpu-threads=",14)) r.CPU_THREADS = atoi(a+14);
+        else if (!strncmp(a,"--shapes=",9))       r.SHAPES = a+9;
+        else if (!strncmp(a,"--winners=",10))     r.WINNERS = a+10;
+        else if (!strncmp(a,"--kernel=",9))       r.KERNEL = a+9;
+        else if (!strncmp(a,"--qtype=",8))        r.QTYPE = a+8;
+        else if (!strncmp(a,"--mem=",6))          r.MEM = parse_mem_place(a+6);
+        else if (!strncmp(a,"--epilogue=",11))    r.EPILOGUE = epilogue_arg(a+11);
+        else if (!strncmp(a,"--alpha=",8))        r.ALPHA = (float)atof(a+8);
+        else if (!strncmp(a,"--beta=",7))         r.BETA = (float)atof(a+7);
+        else if (!strncmp(a,"--fuse=",7))         r.FUSE = a+7;
+        else if (!strncmp(a,"--bandwidth=",12))   r.BANDWIDTH_MIB = atoi(a+12);
+        else if (!strncmp(a,"--peak-gflops=",14)) r.PEAK_GFLOPS = atof(a+14);
+        else if (!strncmp(a,"--panel-mib=",12))   r.PANEL_MIB = atoi(a+12);
+        else if (!strncmp(a,"--temp-max=",11))    r.TEMP_MAX = atof(a+11);
+        else if (!strncmp(a,"--cooldown=",11))    r.COOLDOWN_S = atoi(a+11);
+        else if (!strncmp(a,"--throttle-retries=",19)) r.THROTTLE_RETRIES = atoi(a+19);
+        else if (!strncmp(a,"--order=",8))        r.ORDER = a+8;
+        else if (!strncmp(a,"--hwmon=",8))        r.HWMON = a+8;
+        else if (!strncmp(a,"--pack-calls=",13))  r.PACK_CALLS = atoi(a+13);
+        else if (!strncmp(a,"--latency=",10))     r.LATENCY = atoi(a+10);
+        else if (!strncmp(a,"--layers=",9))       r.LAYERS = atoi(a+9);
+        else if (!strncmp(a,"--streams=",10))     r.STREAMS = a+10;
+        else if (!strncmp(a,"--stream-top=",13))  r.STREAM_TOP = atoi(a+13);
+        else if (!strncmp(a,"--rank=",7))         r.RANK = a+7;
+    }
     if (const char* s=getenv("AT_M")) r.M=std::atoi(s);
     if (const char* s=getenv("AT_N")) r.N=std::atoi(s);
     if (const char* s=getenv("AT_K")) r.K=std::atoi(s);
+    if (const char* s=getenv("AT_BATCH")) r.BATCH=std::max(1, std::atoi(s));
     if (const char* s=getenv("AT_WARM")) r.WARM=std::atoi(s);
     if (const char* s=getenv("AT_REP")) r.REP=std::atoi(s);
     if (const char* s=getenv("AT_TIMEOUT_MS")) r.TIMEOUT_MS=std::strtoull(s,nullptr,10);
     if (const char* s=getenv("AT_CSV")) r.CSV=s;
     if (const char* s=getenv("AT_SMEM_FRAC")) r.SMEM_FRAC=std::max(0.5, std::min(1.0, atof(s)));
+    if (const char* s=getenv("AT_DB")) r.DB=s;
+    if (const char* s=getenv("AT_RESUME")) r.RESUME=atoi(s)!=0;
+    if (const char* s=getenv("AT_PIPELINE_CACHE")) r.PIPELINE_CACHE=s;
+    if (const char* s=getenv("AT_PRECOMPILE")) r.PRECOMPILE=atoi(s)!=0;
+    if (const char* s=getenv("AT_COMPILE_THREADS")) r.COMPILE_THREADS=atoi(s);
+    if (const char* s=getenv("AT_COMPILE_AHEAD")) r.COMPILE_AHEAD=atoi(s);
+    if (!r.COMPILE_THREADS) r.COMPILE_THREADS = std::max(1u, std::thread::hardware_concurrency());
+    if (const char* s=getenv("AT_SEARCH")) r.SEARCH=s;
+    if (const char* s=getenv("AT_PROBE_REP")) r.PROBE_REP=atoi(s);
+    if (const char* s=getenv("AT_ETA")) r.ETA=atoi(s);
+    if (const char* s=getenv("AT_MODEL_BUDGET_S")) r.MODEL_BUDGET_S=atof(s);
+    if (const char* s=getenv("AT_MODEL_BATCH")) r.MODEL_BATCH=atoi(s);
+    if (const char* s=getenv("AT_MODEL_INIT")) r.MODEL_INIT=atoi(s);
+    if (const char* s=getenv("AT_PRUNE_FACTOR")) r.PRUNE_FACTOR=atof(s);
+    if (const char* s=getenv("AT_CHUNK")) r.CHUNK=atoi(s);
+    if (const char* s=getenv("AT_SLICE_MS")) r.SLICE_MS=std::strtoull(s,nullptr,10);
+    if (const char* s=getenv("AT_BUDGET_MS")) r.BUDGET_MS=std::strtoull(s,nullptr,10);
+    if (const char* s=getenv("AT_CV_MAX")) r.CV_MAX=atof(s);
+    if (const char* s=getenv("AT_CV_RETRIES")) r.CV_RETRIES=atoi(s);
+    if (const char* s=getenv("AT_OUTLIER_K")) r.OUTLIER_K=atof(s);
+    if (const char* s=getenv("AT_VERIFY")) r.VERIFY=atoi(s)!=0;
+    if (const char* s=getenv("AT_SEED")) r.SEED=strtoul(s,nullptr,10);
+    if (const char* s=getenv("AT_VERIFY_RTOL")) r.VERIFY_RTOL=atof(s);
+    if (const char* s=getenv("AT_VERIFY_ATOL")) r.VERIFY_ATOL=atof(s);
+    if (const char* s=getenv("AT_VERIFY_ULP")) r.VERIFY_ULP=atoi(s);
+    if (const char* s=getenv("AT_CPU_THREADS")) r.CPU_THREADS=atoi(s);
+    if (const char* s=getenv("AT_SHAPES")) r.SHAPES=s;
+    if (const char* s=getenv("AT_WINNERS")) r.WINNERS=s;
+    if (const char* s=getenv("AT_KERNEL")) r.KERNEL=s;
+    if (const char* s=getenv("AT_QTYPE")) r.QTYPE=s;
+    if (const char* s=getenv("AT_MEM")) r.MEM=parse_mem_place(s);
+    if (const char* s=getenv("AT_EPILOGUE")) r.EPILOGUE=epilogue_arg(s);
+    if (const char* s=getenv("AT_ALPHA")) r.ALPHA=(float)atof(s);
+    if (const char* s=getenv("AT_BETA")) r.BETA=(float)atof(s);
+    if (const char* s=getenv("AT_FUSE")) r.FUSE=s;
+    if (const char* s=getenv("AT_BANDWIDTH")) r.BANDWIDTH_MIB=atoi(s);
+    if (const char* s=getenv("AT_PEAK_GFLOPS")) r.PEAK_GFLOPS=atof(s);
+    if (const char* s=getenv("AT_PANEL_MIB")) r.PANEL_MIB=atoi(s);
+    if (const char* s=getenv("AT_TEMP_MAX")) r.TEMP_MAX=atof(s);
+    if (const char* s=getenv("AT_COOLDOWN")) r.COOLDOWN_S=atoi(s);
+    if (const char* s=getenv("AT_THROTTLE_RETRIES")) r.THROTTLE_RETRIES=atoi(s);
+    if (const char* s=getenv("AT_ORDER")) r.ORDER=s;
+    if (const char* s=getenv("AT_HWMON")) r.HWMON=s;
+    if (const char* s=getenv("AT_PACK_CALLS")) r.PACK_CALLS=atoi(s);
+    if (const char* s=getenv("AT_LATENCY")) r.LATENCY=atoi(s);
+    if (const char* s=getenv("AT_LAYERS")) r.LAYERS=atoi(s);
+    if (const char* s=getenv("AT_STREAMS")) r.STREAMS=s;
+    if (const char* s=getenv("AT_STREAM_TOP")) r.STREAM_TOP=atoi(s);
+    if (const char* s=getenv("AT_RANK")) r.RANK=s;
+    if (r.FUSE != "fused" && r.FUSE != "unfused" && r.FUSE != "both") {
+        fprintf(stderr, "Unknown --fuse=%s (fused|unfused|both)\n", r.FUSE.c_str());
+        std::exit(1);
+    }
+    if (r.ORDER != "grid" && r.ORDER != "shuffle") {
+        fprintf(stderr, "Unknown --order=%s (grid|shuffle)\n", r.ORDER.c_str());
+        std::exit(1);
+    }
+    if (r.RANK != "latency" && r.RANK != "throughput") {
+        fprintf(stderr, "Unknown --rank=%s (latency|throughput)\n", r.RANK.c_str());
+        std::exit(1);
+    }
+    if (r.RANK == "throughput" && r.STREAMS.empty()) {
+        fprintf(stderr, "--rank=throughput needs --streams=\n");
+        std::exit(1);
+    }
+    if (!r.BUDGET_MS) r.BUDGET_MS = r.TIMEOUT_MS;
+    r.SLICE_MS = std::max<uint64_t>(1, r.SLICE_MS);
+    if (!r.PROBE_REP) r.PROBE_REP = std::max(1u, r.REP / 8u);
+    r.MODEL_BATCH = std::max(1u, r.MODEL_BATCH);
+    r.ETA = std::max(2u, r.ETA);
+    r.PRUNE_FACTOR = std::max(1.0, r.PRUNE_FACTOR);
+    r.LAYERS = std::max(1u, r.LAYERS);
+    r.STREAM_TOP = std::max(1u, r.STREAM_TOP);
     return r;
 }
 
-static VkShaderModule make_shader(VkDevice dev, const std::vector<uint32_t>& spv){
-    VkShaderModuleCreateInfo ci{VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO};
-    ci.codeSize = spv.size()*sizeof(uint32_t);
-    ci.pCode = spv.data();
-    VkShaderModule mod;
-    VK_CHECK(vkCreateShaderModule(dev, &ci, nullptr, &mod));
-    return mod;
+// One GEMM problem of a multi-shape sweep: C[MxN] = A[MxK] * B[KxN], `batch`
+// times over densely packed operands (attention heads)
+struct Shape { std::string name; uint32_t M, N, K; uint32_t batch = 1; };
+
+// "MxNxK[*B][,...]" or "@file" with one shape per line: "MxNxK[*B] [name]",
+// '#' starts a comment. Empty spec = the single AT_M/AT_N/AT_K/AT_BATCH problem.
+static std::vector<Shape> parse_shapes(const RunCfg& cfg) {
+    std::vector<Shape> out;
+    if (cfg.SHAPES.empty()) { out.push_back({"", cfg.M, cfg.N, cfg.K, cfg.BATCH}); return out; }
+    std::string text = cfg.SHAPES;
+    if (text[0] == '@') {
+        FILE* f = fopen(text.c_str()+1, "r");
+        if (!f) { fprintf(stderr, "Cannot open shape file %s\n", text.c_str()+1); exit(1); }
+        text.clear();
+        char line[512];
+        while (fgets(line, sizeof(line), f)) {
+            if (char* h = strchr(line, '#')) *h = 0;
+            text += line; text += '\n';
+        }
+        fclose(f);
+    } else {
+        for (char& c : text) if (c == ',') c = '\n';
+    }
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t eol = text.find('\n', pos); if (eol == std::string::npos) eol = text.size();
+        std::string line = text.substr(pos, eol - pos); pos = eol + 1;
+        Shape sh{"", 0, 0, 0};
+        char name[256] = "";
+        int used = 0;
+        int n = sscanf(line.c_str(), " %ux%ux%u%n", &sh.M, &sh.N, &sh.K, &used);
+        if (n == EOF || (n <= 0 && line.find_first_not_of(" \t\r") == std::string::npos)) continue;
+        bool ok = n == 3 && sh.M && sh.N && sh.K;
+        const char* rest = line.c_str() + (ok ? used : 0);
+        if (ok && *rest == '*') { int u = 0; ok = sscanf(rest, "*%u%n", &sh.batch, &u) == 1 && sh.batch; rest += u; }
+        if (!ok) { fprintf(stderr, "Bad shape '%s' (want MxNxK[*B] [name])\n", line.c_str()); exit(1); }
+        if (sscanf(rest, " %255s", name) == 1) sh.name = name;
+        out.push_back(sh);
+    }
+    if (out.empty()) { fprintf(stderr, "No shapes in '%s'\n", cfg.SHAPES.c_str()); exit(1); }
+    return out;
 }
 
-int main(int argc, char** argv){
-    VulkanCtx C; init_vulkan(C);
-    auto cfg = env_runcfg();
-
-    // Allocate buffers (FP32)
-    size_t sizeA = (size_t)cfg.M * cfg.K * sizeof(float);
-    size_t sizeB = (size_t)cfg.K * cfg.N * sizeof(float);
-    size_t sizeC = (size_t)cfg.M * cfg.N * sizeof(float);
-    create_buffer(C, sizeA, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, C.bufA, C.memA);
-    create_buffer(C, sizeB, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, C.bufB, C.memB);
-    create_buffer(C, sizeC, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, C.bufC, C.memC);
-
-    // Fill A,B with 1.0f
-    void* p;
-    vkMapMemory(C.device, C.memA, 0, VK_WHOLE_SIZE, 0, &p); std::fill_n((float*)p, (sizeA/4), 1.0f); vkUnmapMemory(C.device, C.memA);
-    vkMapMemory(C.device, C.memB, 0, VK_WHOLE_SIZE, 0, &p); std::fill_n((float*)p, (sizeB/4), 1.0f); vkUnmapMemory(C.device, C.memB);
-
-    // Descriptor set
-    VkDescriptorSetAllocateInfo dsai{VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
-    dsai.descriptorPool = C.dpool; dsai.descriptorSetCount=1; dsai.pSetLayouts=&C.dsl;
-    VkDescriptorSet dset; VK_CHECK(vkAllocateDescriptorSets(C.device, &dsai, &dset));
+// Out-of-core split of a shape (--panel-mib=): used when A, B or C of the
+// whole batch is over `limit` bytes. Each step multiplies an Mt x Kt panel of
+// A by a Kt x Nt panel of B into an Mt x Nt tile of C, all of at most `panel`
+// bytes; M and N are cut first (multiples of 64), K only when a 64-row panel
+// is still too big, since every extra K block re-reads the C tile.
+struct OocPlan { bool on = false; uint32_t Mt = 0, Nt = 0, Kt = 0; };
+static OocPlan ooc_plan(const Shape& sh, uint64_t limit, uint64_t panel) {
+    OocPlan p;
+    const uint64_t b = sh.batch, e = panel / sizeof(float);
+    p.on = 4 * b * sh.M * sh.K > limit || 4 * b * sh.K * sh.N > limit || 4 * b * sh.M * sh.N > limit;
+    if (!p.on) return p;
+    p.Mt = sh.M; p.Nt = sh.N; p.Kt = sh.K;
+    for (;;) {
+        const bool a = uint64_t(p.Mt) * p.Kt > e, bb = uint64_t(p.Kt) * p.Nt > e, c = uint64_t(p.Mt) * p.Nt > e;
+        if (!a && !bb && !c) break;
+        uint32_t& d = c ? (p.Mt >= p.Nt ? p.Mt : p.Nt) : a ? (p.Mt > 64 ? p.Mt : p.Kt) : (p.Nt > 64 ? p.Nt : p.Kt);
+        if (d <= 64) break;   // panel budget below 64 x 64 floats
+        d = std::max(64u, ceil_div(d / 2, 64) * 64);
+    }
+    return p;
+}
 
-    VkDescriptorBufferInfo biA{C.bufA,0,sizeA}, biB{C.bufB,0,sizeB}, biC{C.bufC,0,sizeC};
-    VkWriteDescriptorSet w[3]{};
-    for (int i=0;i<3;i++){ w[i].sType=VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET; w[i].dstSet=dset; w[i].dstBinding=i; w[i].descriptorCount=1; w[i].descriptorType=VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; }
-    w[0].pBufferInfo=&biA; w[1].pBufferInfo=&biB; w[2].pBufferInfo=&biC;
-    vkUpdateDescriptorSets(C.device, 3, w, 0, nullptr);
+// Per-dispatch timing statistics (usec), after outlier rejection
+struct Stats { double min=0.0, median=0.0, p95=0.0, stddev=0.0, cv=0.0; uint32_t outliers=0; };
+
+// Outcome of timing one candidate. usec/gflops are the mean over the kept
+// samples; ranking uses st.median.
+// Hybrid runs time the wall clock of each GEMM; cpu_usec/gpu_usec are the
+// mean CPU share and GPU dispatch time within it.
+// temp_c (hottest zone around the run), the clocks after it and the mean
+// watts over it come from sysfs and are not kept in the DB (NaN/0 = unknown).
+struct Meas { std::string status = "OK"; double usec = 0.0, gflops = 0.0, gbps = 0.0; uint32_t reps_done = 0; Stats st; bool verified = false;
+              double cpu_usec = 0.0, gpu_usec = 0.0;
+              double temp_c = NAN, cpu_mhz = 0.0, gpu_mhz = 0.0, watts = NAN; bool throttled = false; };
+
+// ---------------------------------------------------------------------------
+// Persistent tuning DB
+//
+// Append-only TSV, one line per measured candidate:
+//   key <TAB> status <TAB> usec_per_iter <TAB> gflops <TAB> unix_time
+//       [<TAB> min <TAB> median <TAB> p95 <TAB> stddev <TAB> cv <TAB> outliers [<TAB> verified]]
+// The key pins everything that can change a result (device UUID, driver
+// version, SPIR-V hash, spec constants, M/N/K/WARM/REP), so a driver update or
+// shader edit simply misses the old records. Later lines win over earlier ones.
+// Each line is flushed + fsync'd so a crash or power cut loses at most the
+// candidate that was in flight.
+// ---------------------------------------------------------------------------
+static const char* kDbMagic = "# vk-autotune-db v1";
+
+struct DbRec { Meas m; uint64_t when=0; };
+
+struct TuneDb {
+    std::unordered_map<std::string, DbRec> recs;
+    FILE* out = nullptr;
+};
 
-    // Load shader
-    std::string spv_path = std::string("shaders/gemm.spv"); // in build dir
-    auto spv = load_spirv(spv_path.c_str());
-    VkShaderModule mod = make_shader(C.device, spv);
+static uint64_t fnv1a64(const void* data, size_t n, uint64_t h = 1469598103934665603ull) {
+    const uint8_t* p = (const uint8_t*)data;
+    for (size_t i=0;i<n;i++){ h ^= p[i]; h *= 1099511628211ull; }
+    return h;
+}
 
-    // Build candidate grid
-    auto grid = build_grid(C.props, C.subprops.subgroupSize, argc, argv);
+// Device/driver/shader part of the key; shared by every candidate of a run.
+static std::string db_prefix(const VulkanCtx& C, const std::vector<uint32_t>& spv) {
+    char buf[128]; int o = snprintf(buf, sizeof(buf), "uuid=");
+    for (int i=0;i<VK_UUID_SIZE;i++) o += snprintf(buf+o, sizeof(buf)-o, "%02x", C.device_uuid[i]);
+    snprintf(buf+o, sizeof(buf)-o, ";drv=%u;spv=%016llx", C.props.driverVersion,
+             (unsigned long long)fnv1a64(spv.data(), spv.size()*sizeof(uint32_t)));
+    return buf;
+}
 
-    // CSV header
-    FILE* csv = nullptr;
-    if (cfg.CSV) {
-        csv = fopen(cfg.CSV, "w");
-        if (csv) fprintf(csv, "TM,TN,TK,lszx,lszy,smem,M,N,K,WARM,REP,status,usec_per_iter,gflops\n");
+// timing=pd: per-dispatch timestamps with barriers (older whole-loop records miss)
+static std::string db_key(const std::string& prefix, const Cand& g, const RunCfg& cfg) {
+    char buf[192];
+    snprintf(buf, sizeof(buf), ";TM=%u;TN=%u;TK=%u;lsz=%ux%u;smem=%u;SH=%u;M=%u;N=%u;K=%u;WARM=%u;REP=%u;timing=pd",
+             g.TM,g.TN,g.TK,g.lszx,g.lszy,g.smem, g.TM*g.TK + g.TK*g.TN,
+             cfg.M,cfg.N,cfg.K,cfg.WARM,cfg.REP);
+    std::string key = prefix + buf;
+    if (g.fam == 1) {
+        snprintf(buf, sizeof(buf), ";v2;vec=%u;dbuf=%u;pad=%u", g.vec, g.dbuf, g.pad);
+        key += buf;
+    }
+    if (g.splitk > 1) key += ";splitk=" + std::to_string(g.splitk);
+    if (g.cpu) key += ";cpu=" + std::to_string(g.cpu);
+    if (g.packb) key += ";packb=1";
+    if (cfg.BATCH > 1) key += ";batch=" + std::to_string(cfg.BATCH);
+    if (g.epi) {
+        snprintf(buf, sizeof(buf), ";epi=%s;fused=%u", epilogue_name(g.epi).c_str(), g.fused);
+        key += buf;
     }
+    // Host-coherent was the only placement before --mem; its keys stay unchanged.
+    // Others name the memory type they got, which may be a fallback.
+    if (cfg.MEM != MemPlace::Coherent) key += ";mem=" + cfg.MEM_USED;
+    // GPU-only times taken next to hybrid ones are not device timestamps
+    if (cfg.WALL && !g.cpu) key += ";clock=wall";
+    return key;
+}
 
-    uint32_t idx=0;
-    for (const auto& g : grid) {
-        idx++;
-        printf("[%u/%zu] TM=%u TN=%u TK=%u lsz=(%u,%u) smem=%u  ...\n",
-            idx, grid.size(), g.TM,g.TN,g.TK,g.lszx,g.lszy,g.smem);
-        fflush(stdout);
+// PARTIAL (over the time budget) is settled; PRUNED only for a halving search.
+// A --verify run does not trust results that were never checked.
+static bool db_valid(const DbRec& r, bool halving, bool verify) {
+    const std::string& s = r.m.status;
+    if (verify && s != "PRUNED" && !r.m.verified) return false;
+    return s == "OK" || s == "PARTIAL" || (halving && s == "PRUNED");
+}
 
-        // SMEM budget check with optional safety fraction
-        uint32_t budget = (uint32_t)(C.props.limits.maxComputeSharedMemorySize * std::min(std::max(cfg.SMEM_FRAC,0.5),1.0));
-        uint32_t needed_bytes = 4u * g.TK * (g.TM + g.TN);
-        if (g.smem && needed_bytes > budget) {
-            fprintf(stdout, "  -> [SKIP] needs %uB > budget %uB\n", needed_bytes, budget);
-            if (csv) fprintf(csv, "%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,SKIP_SMEM_BUDGET,0.0,0.0\n",
-                g.TM,g.TN,g.TK,g.lszx,g.lszy,g.smem,cfg.M,cfg.N,cfg.K,cfg.WARM,cfg.REP);
-            continue;
+static void db_open(TuneDb& db, const std::string& path) {
+    if (path.empty()) return;
+    bool fresh = true;
+    if (FILE* f = fopen(path.c_str(), "r")) {
+        char line[4096]; bool magic_ok = false, any = false;
+        while (fgets(line, sizeof(line), f)) {
+            any = true;
+            if (line[0]=='#') { if (!strncmp(line, kDbMagic, strlen(kDbMagic))) magic_ok = true; continue; }
+            if (!magic_ok) break;
+            char* tab[11]; char* q = line; int nt = 0;
+            for (; *q && nt<11; ++q) if (*q=='\t') { *q = 0; tab[nt++] = q+1; }
+            if (nt < 4) continue;
+            DbRec r;
+            r.m.status = std::string(tab[0]);
+            r.m.usec   = atof(tab[1]);
+            r.m.gflops = atof(tab[2]);
+            r.when     = strtoull(tab[3], nullptr, 10);
+            if (nt >= 10) {
+                r.m.st.min    = atof(tab[4]);
+                r.m.st.median = atof(tab[5]);
+                r.m.st.p95    = atof(tab[6]);
+                r.m.st.stddev = atof(tab[7]);
+                r.m.st.cv     = atof(tab[8]);
+                r.m.st.outliers = (uint32_t)atoi(tab[9]);
+                r.m.verified = nt >= 11 && atoi(tab[10]) != 0;
+            } else {
+                r.m.st.min = r.m.st.median = r.m.st.p95 = r.m.usec;
+            }
+            db.recs[line] = r;
+        }
+        fclose(f);
+        if (any && !magic_ok) {
+            fprintf(stderr, "# tuning-db %s is not a %s file; not touching it\n", path.c_str(), kDbMagic+2);
+            return;
         }
+        fresh = !any;
+    }
+    db.out = fopen(path.c_str(), fresh ? "w" : "a");
+    if (!db.out) { perror("fopen tuning db"); return; }
+    if (fresh) fprintf(db.out, "%s\n", kDbMagic);
+    fprintf(stderr, "# tuning-db=%s  records=%zu\n", path.c_str(), db.recs.size());
+}
 
-        // Spec constants: 0->LSX,1->LSY, 2->TM,3->TN,4->TK,5->USE_SMEM,6->SH_ELEMS
-        uint32_t SH_ELEMS = g.TM*g.TK + g.TK*g.TN;
-        struct Spec { uint32_t lsx, lsy, TM, TN, TK, USE_SMEM, SH_ELEMS; }
-            spec = { g.lszx, g.lszy, g.TM, g.TN, g.TK, g.smem, SH_ELEMS };
-        VkSpecializationMapEntry me[7];
-        for (uint32_t i=0;i<7;i++){ me[i].constantID=i; me[i].offset=i*sizeof(uint32_t); me[i].size=sizeof(uint32_t); }
-        VkSpecializationInfo si{}; si.mapEntryCount=7; si.pMapEntries=me; si.dataSize=sizeof(Spec); si.pData=&spec;
+static void db_put(TuneDb& db, const std::string& key, const DbRec& r) {
+    db.recs[key] = r;
+    if (!db.out) return;
+    const Stats& st = r.m.st;
+    fprintf(db.out, "%s\t%s\t%.6f\t%.6f\t%llu\t%.6f\t%.6f\t%.6f\t%.6f\t%.6f\t%u\t%d\n",
+            key.c_str(), r.m.status.c_str(), r.m.usec, r.m.gflops, (unsigned long long)r.when,
+            st.min, st.median, st.p95, st.stddev, st.cv, st.outliers, r.m.verified ? 1 : 0);
+    fflush(db.out);
+    fsync(fileno(db.out));
+}
 
-        VkPipelineShaderStageCreateInfo ss{VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO};
-        ss.stage = VK_SHADER_STAGE_COMPUTE_BIT; ss.module = mod; ss.pName = "main"; ss.pSpecializationInfo = &si;
+// Build pipelines for every candidate flagged in `todo` on a pool of worker
+// threads, so the measurement loop never waits on the shader compiler.
+// Returns the wall time spent.
+static double precompile(const VulkanCtx& C, const VkShaderModule* mods, VkPipelineCache cache,
+                         const std::vector<Cand>& grid, const std::vector<uint8_t>& todo,
+                         uint32_t nthreads, std::vector<VkPipeline>& pipes, std::vector<VkResult>& res) {
+    pipes.assign(grid.size(), VK_NULL_HANDLE);
+    res.assign(grid.size(), VK_NOT_READY);
+    std::vector<size_t> work;
+    for (size_t i=0;i<grid.size();i++) if (todo[i]) work.push_back(i);
+    if (work.empty()) return 0.0;
+    nthreads = std::max(1u, std::min<uint32_t>(nthreads, (uint32_t)work.size()));
+
+    auto t0 = std::chrono::steady_clock::now();
+    std::atomic<size_t> next{0}, done{0};
+    auto worker = [&](){
+        for (size_t w; (w = next.fetch_add(1)) < work.size(); ) {
+            size_t i = work[w];
+            res[i] = create_pipeline(C, mods, cache, grid[i], &pipes[i]);
+            size_t d = ++done;
+            if (d == work.size() || d % 8 == 0) { fprintf(stderr, "\r# compiling %zu/%zu", d, work.size()); }
+        }
+    };
+    std::vector<std::thread> pool;
+    for (uint32_t t=1;t<nthreads;t++) pool.emplace_back(worker);
+    worker();
+    for (auto& th : pool) th.join();
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    fprintf(stderr, "\n# precompiled %zu pipelines on %u threads in %.2fs\n", work.size(), nthreads, secs);
+    return secs;
+}
 
-        VkComputePipelineCreateInfo pci{VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
-        pci.stage = ss; pci.layout = C.ppl;
-        VkPipeline pipe;
-        VkResult perr = vkCreateComputePipelines(C.device, VK_NULL_HANDLE, 1, &pci, nullptr, &pipe);
-        if (perr != VK_SUCCESS) {
-            fprintf(stdout, "  -> [COMPILE_FAIL]\n");
-            if (csv) fprintf(csv, "%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,COMPILE_FAIL,0.0,0.0\n",
-                g.TM,g.TN,g.TK,g.lszx,g.lszy,g.smem,cfg.M,cfg.N,cfg.K,cfg.WARM,cfg.REP);
-            continue;
+// --precompile=0: one background thread builds pipelines in the order the
+// measurement loop asks for them, at most `depth` ahead of it, so compiling
+// the next candidate overlaps with timing the current one on the GPU.
+struct PipeFeeder {
+    const VulkanCtx* C = nullptr;
+    const VkShaderModule* mods = nullptr;
+    VkPipelineCache cache = VK_NULL_HANDLE;
+    const std::vector<Cand>* grid = nullptr;
+    std::vector<VkPipeline>* pipes = nullptr;
+    std::vector<VkResult>* res = nullptr;
+
+    std::vector<size_t> order;          // compile order
+    std::vector<uint8_t> ready, taken;
+    uint32_t depth = 2, ahead = 0;      // ahead = built but not yet taken
+    size_t wanted = SIZE_MAX;           // the loop is blocked on this one
+    bool stop = false;
+    double compile_s = 0.0, wait_s = 0.0;
+    std::mutex mu;
+    std::condition_variable cv;
+    std::thread th;
+
+    void start() {
+        ready.assign(grid->size(), 0); taken.assign(grid->size(), 0);
+        th = std::thread([this]{
+            for (size_t gi : order) {
+                {
+                    std::unique_lock<std::mutex> lk(mu);
+                    // The bounded queue keeps at most `depth` idle pipelines alive,
+                    // unless the loop is already waiting on this very one
+                    cv.wait(lk, [&]{ return stop || ahead < depth || wanted == gi; });
+                    if (stop) return;
+                }
+                auto t0 = std::chrono::steady_clock::now();
+                VkResult r = create_pipeline(*C, mods, cache, (*grid)[gi], &(*pipes)[gi]);
+                double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+                std::lock_guard<std::mutex> lk(mu);
+                (*res)[gi] = r; ready[gi] = 1; ahead++; compile_s += s;
+                cv.notify_all();
+            }
+        });
+    }
+    // Block until candidate gi is built; the loop owns it from here on
+    VkResult take(size_t gi) {
+        std::unique_lock<std::mutex> lk(mu);
+        if (!ready[gi]) {
+            auto t0 = std::chrono::steady_clock::now();
+            wanted = gi; cv.notify_all();
+            cv.wait(lk, [&]{ return ready[gi] != 0; });
+            wanted = SIZE_MAX;
+            wait_s += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
         }
+        if (!taken[gi]) { taken[gi] = 1; ahead--; cv.notify_all(); }
+        return (*res)[gi];
+    }
+    void finish() {
+        { std::lock_guard<std::mutex> lk(mu); stop = true; cv.notify_all(); }
+        if (th.joinable()) th.join();
+    }
+};
 
-        // Command buffer
-        VkCommandBufferAllocateInfo cbai{VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
-        cbai.commandPool = C.cpool; cbai.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY; cbai.commandBufferCount = 1;
-        VkCommandBuffer cb; VK_CHECK(vkAllocateCommandBuffers(C.device, &cbai, &cb));
+// --packb: move every packed candidate up to the first one in `order` with the
+// same (TK, TN), so B is packed once per layout instead of on nearly every
+// switch of a shuffled order. Everything else keeps its place.
+static void group_packed(const std::vector<Cand>& grid, std::vector<size_t>& order) {
+    std::vector<size_t> out;
+    out.reserve(order.size());
+    std::map<std::pair<uint32_t,uint32_t>, std::vector<size_t>> layout;
+    for (size_t gi : order) if (grid[gi].packb) layout[{grid[gi].TK, grid[gi].TN}].push_back(gi);
+    for (size_t gi : order) {
+        const Cand& g = grid[gi];
+        if (!g.packb) { out.push_back(gi); continue; }
+        auto& same = layout[{g.TK, g.TN}];
+        out.insert(out.end(), same.begin(), same.end());
+        same.clear();
+    }
+    order = std::move(out);
+}
 
-        VkCommandBufferBeginInfo cbi{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
-        VK_CHECK(vkBeginCommandBuffer(cb, &cbi));
+// q-quantile of sorted, non-empty x, interpolated between neighbouring samples
+static double percentile(const std::vector<double>& x, double q) {
+    double pos = q * double(x.size() - 1);
+    size_t lo = (size_t)pos; size_t hi = std::min(lo + 1, x.size() - 1);
+    return x[lo] + (x[hi] - x[lo]) * (pos - double(lo));
+}
+
+// min/median/p95/stddev/CV of per-dispatch times. Samples further than
+// OUTLIER_K robust sigmas (1.4826 * MAD) from the median are dropped first;
+// the mean of the kept samples is returned.
+static double compute_stats(std::vector<double> v, double outlier_k, Stats& st) {
+    st = Stats{};
+    if (v.empty()) return 0.0;
+    std::sort(v.begin(), v.end());
+    if (outlier_k > 0.0 && v.size() >= 4) {
+        double med = percentile(v, 0.5);
+        std::vector<double> dev(v.size());
+        for (size_t i=0;i<v.size();i++) dev[i] = std::fabs(v[i] - med);
+        std::sort(dev.begin(), dev.end());
+        double sigma = 1.4826 * percentile(dev, 0.5);
+        if (sigma > 0.0) {
+            size_t n0 = v.size();
+            v.erase(std::remove_if(v.begin(), v.end(), [&](double x){ return std::fabs(x - med) > outlier_k * sigma; }), v.end());
+            st.outliers = (uint32_t)(n0 - v.size());
+        }
+    }
+    double sum = 0.0; for (double x : v) sum += x;
+    double mean = sum / double(v.size());
+    double var = 0.0; for (double x : v) var += (x - mean) * (x - mean);
+    st.min    = v.front();
+    st.median = percentile(v, 0.5);
+    st.p95    = percentile(v, 0.95);
+    st.stddev = v.size() > 1 ? std::sqrt(var / double(v.size() - 1)) : 0.0;
+    st.cv     = mean > 0.0 ? st.stddev / mean : 0.0;
+    return mean;
+}
+
+// One kernel launch as timed by run_candidate: pipeline, bindings, push
+// constants, grid, and the work per dispatch used for GFLOP/s and GB/s.
+struct Launch {
+    VkPipeline pipe = VK_NULL_HANDLE;
+    VkPipelineLayout layout = VK_NULL_HANDLE;
+    VkDescriptorSet dset = VK_NULL_HANDLE;
+    std::vector<uint32_t> push;
+    uint32_t gx = 1, gy = 1, gz = 1;
+    double flops = 0.0;
+    double bytes = 0.0; // bytes moved per dispatch (weights, bandwidth kernel; 0 = not reported)
+    // Passes recorded after each dispatch (split-K reduction, unfused
+    // epilogue), same layout, each behind a barrier; timed together with it
+    struct Pass {
+        VkPipeline pipe = VK_NULL_HANDLE;
+        VkDescriptorSet dset = VK_NULL_HANDLE;
+        std::vector<uint32_t> push;
+        uint32_t gx = 1, gy = 1, gz = 1;
+    };
+    std::vector<Pass> post;
+    // Hybrid mode: CPU share of the GEMM, run on the submitting thread while
+    // each dispatch executes; timing is then per dispatch and wall clock
+    std::function<void()> host;
+    // Wall clock timing without a CPU share, so GPU-only candidates compare
+    // with hybrid ones (RunCfg::WALL)
+    bool wall = false;
+};
 
-        // Reset timestamps
-        vkCmdResetQueryPool(cb, C.qpool, 0, 2);
+// Descriptor sets of the GEMM path (binding 3 is always the bias):
+//   direct (A,B,C)   split (A,B,W)   reduce (W,-,C)
+//   unfused epilogue: to_t (A,B,T), reduce_t (W,-,T), epi (T,-,C)
+//   packed B: direct_p, split_p, to_t_p as above with P in place of B
+// reduce_pipe is reduce_epilogue.comp without an epilogue, epi_pipe with the
+// run's epilogue (only when there is one).
+struct GemmSets {
+    VkDescriptorSet direct = VK_NULL_HANDLE, split = VK_NULL_HANDLE, reduce = VK_NULL_HANDLE;
+    VkDescriptorSet to_t = VK_NULL_HANDLE, reduce_t = VK_NULL_HANDLE, epi = VK_NULL_HANDLE;
+    VkDescriptorSet direct_p = VK_NULL_HANDLE, split_p = VK_NULL_HANDLE, to_t_p = VK_NULL_HANDLE;
+    VkPipeline reduce_pipe = VK_NULL_HANDLE, epi_pipe = VK_NULL_HANDLE;
+};
 
-        // Bind pipeline + descriptors
-        vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, pipe);
-        vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, C.ppl, 0, 1, &dset, 0, nullptr);
+// Rows of M given to the CPU in hybrid mode: the last cpu% of them
+static uint32_t cpu_rows(const Cand& g, uint32_t M) { return uint32_t(uint64_t(M) * g.cpu / 100); }
+
+// Modelled DRAM traffic of one GEMM dispatch with all its passes, ignoring
+// caches: each workgroup streams its TM rows of A and TN columns of B over all
+// of K (without SMEM each thread streams its own RM rows / RN columns), C is
+// written once (and read with beta), split-K partials and the unfused
+// temporary are written and read back once. GPU rows only in hybrid mode.
+static double gemm_bytes(const Cand& g, const RunCfg& cfg) {
+    const double M = cfg.M - cpu_rows(g, cfg.M), N = cfg.N, K = cfg.K;
+    const double rm = g.smem ? g.TM : ceil_div(g.TM, g.lszy), rn = g.smem ? g.TN : ceil_div(g.TN, g.lszx);
+    const double c = M * N;
+    // packed B is read with its zero padding
+    const double kn = g.packb ? double(packed_b_floats(cfg.K, cfg.N, g.TK, g.TN)) : K * N;
+    double f = M * K * std::ceil(N / rn) + kn * std::ceil(M / rm) + c;
+    if (g.epi & EPI_SCALE) f += c;
+    if (splitk_slices(g, cfg.K) > 1) f += 2.0 * c * splitk_slices(g, cfg.K);
+    if (g.epi && !g.fused) f += 2.0 * c;
+    return 4.0 * f * cfg.BATCH;
+}
 
-        // Push constants
-        struct Push { uint32_t M,N,K,lda,ldb,ldc; } push = { cfg.M, cfg.N, cfg.K, cfg.K, cfg.N, cfg.N };
-        vkCmdPushConstants(cb, C.ppl, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(Push), &push);
+// Roofline position of a measured GPU-only candidate: arithmetic intensity
+// (FLOP per modelled byte), attainable GFLOP/s min(peak, AI x bandwidth) and
+// the fraction of it reached. peak 0 = memory roof only. Hybrid candidates get
+// the AI of their GPU share but no roof, their GFLOP/s include the CPU.
+struct Roof { double bytes = 0.0, ai = 0.0, gflops = 0.0, eff = 0.0; };
+static Roof roofline(const Cand& g, const RunCfg& cfg, double gflops, double bw_gbps, double peak_gflops) {
+    Roof r;
+    r.bytes = gemm_bytes(g, cfg);
+    r.ai = 2.0 * double(cfg.M - cpu_rows(g, cfg.M)) * cfg.N * cfg.K * cfg.BATCH / r.bytes;
+    if (bw_gbps <= 0.0 || g.cpu) return r;
+    r.gflops = r.ai * bw_gbps;
+    if (peak_gflops > 0.0) r.gflops = std::min(r.gflops, peak_gflops);
+    r.eff = gflops / r.gflops;
+    return r;
+}
 
-        uint32_t groupsX = ceil_div(cfg.N, g.TN);
-        uint32_t groupsY = ceil_div(cfg.M, g.TM);
+// ---------------------------------------------------------------------------
+// Cost model for --search=model: ridge regression of log2(median usec) on
+// cheap tile/shape features. Fitted on everything measured so far (all
+// shapes), it ranks the unmeasured candidates for the next round.
+// ---------------------------------------------------------------------------
+static std::vector<double> tile_features(const Cand& g, const RunCfg& cfg, uint32_t maxSMEM) {
+    const double RM = ceil_div(g.TM, g.lszy), RN = ceil_div(g.TN, g.lszx);
+    const uint32_t mg = cfg.M - cpu_rows(g, cfg.M);
+    const double gx = ceil_div(cfg.N, g.TN), gy = ceil_div(mg, g.TM);
+    const double slices = splitk_slices(g, cfg.K);
+    const double flops = 2.0 * double(std::max(mg, 1u)) * cfg.N * cfg.K * cfg.BATCH;
+    return {
+        1.0,
+        std::log2(double(g.TM)), std::log2(double(g.TN)), std::log2(double(g.TK)),
+        std::log2(RM * RN),                                     // register tile, ILP
+        std::log2(double(g.lszx * g.lszy)),                     // threads per workgroup
+        g.smem ? double(smem_bytes(g)) / maxSMEM : 0.0,         // SMEM share, occupancy
+        g.smem ? 1.0 : 0.0,
+        std::log2(gx * gy * cfg.BATCH * slices),                // workgroups in flight
+        std::log2(gx * g.TN * gy * g.TM / (double(cfg.N) * std::max(mg, 1u))), // edge waste
+        std::log2(gemm_bytes(g, cfg)),
+        std::log2(flops),
+        double(g.fam), g.vec == 4 ? 1.0 : 0.0, double(g.dbuf), g.pad ? 1.0 : 0.0,
+        std::log2(slices), (g.epi && !g.fused) ? 1.0 : 0.0, g.cpu / 100.0, double(g.packb),
+    };
+}
 
-        // warmup
-        for (uint32_t i=0;i<cfg.WARM;i++) {
-            vkCmdDispatch(cb, groupsX, groupsY, 1);
+struct CostModel {
+    std::vector<double> w;
+    // Solve (X'X + lambda I) w = X'y; the intercept (column 0) is not penalized
+    bool fit(const std::vector<std::vector<double>>& X, const std::vector<double>& y, double lambda = 1e-2) {
+        if (X.empty()) return false;
+        const size_t n = X[0].size();
+        std::vector<std::vector<double>> A(n, std::vector<double>(n + 1, 0.0));
+        for (size_t r=0; r<X.size(); r++)
+            for (size_t i=0;i<n;i++) {
+                for (size_t j=0;j<n;j++) A[i][j] += X[r][i] * X[r][j];
+                A[i][n] += X[r][i] * y[r];
+            }
+        for (size_t i=1;i<n;i++) A[i][i] += lambda * X.size();
+        for (size_t c=0;c<n;c++) {
+            size_t p = c;
+            for (size_t r=c+1;r<n;r++) if (std::fabs(A[r][c]) > std::fabs(A[p][c])) p = r;
+            if (std::fabs(A[p][c]) < 1e-12) return false;
+            std::swap(A[c], A[p]);
+            for (size_t r=0;r<n;r++) {
+                if (r == c) continue;
+                double f = A[r][c] / A[c][c];
+                for (size_t k=c;k<=n;k++) A[r][k] -= f * A[c][k];
+            }
         }
+        w.assign(n, 0.0);
+        for (size_t i=0;i<n;i++) w[i] = A[i][n] / A[i][i];
+        return true;
+    }
+    double predict(const std::vector<double>& x) const {
+        double s = 0.0;
+        for (size_t i=0;i<w.size() && i<x.size();i++) s += w[i] * x[i];
+        return s;
+    }
+};
+
+// gemm.comp: push {M,N,K,lda,ldb,ldc,KS,S,sA,sB,sC,SS,alpha,beta}, one
+// workgroup per TM x TN tile of C and one z layer per batch entry and K slice.
+// The BATCH problems are packed back to back. Split-K writes S partial copies
+// of C to W, SS floats apart, which reduce_epilogue.comp (same push block) sums
+// into C; a split-K candidate whose K fits one slice (S = 1) runs as a plain
+// GEMM, since the kernel then applies the epilogue itself. An unfused epilogue
+// sends the GEMM result to T and applies the epilogue with reduce_epilogue.comp
+// at S = 1.
+// Hybrid candidates dispatch only the first Mg rows (the strides keep the full
+// M) and compute the rest with cpu_sgemm straight into the mapped buffers.
+static Launch gemm_launch(const TuneCtx& C, VkPipeline pipe, const GemmSets& S, const Cand& g, const RunCfg& cfg) {
+    Launch l;
+    l.pipe = pipe; l.layout = C.ppl; l.dset = g.packb ? S.direct_p : S.direct;
+    const uint32_t sA = cfg.M * cfg.K, sB = cfg.K * cfg.N, sC = cfg.M * cfg.N;
+    const uint32_t mg = cfg.M - cpu_rows(g, cfg.M);
+    l.push = gemm_push(g, cfg.M, cfg.N, cfg.K, cfg.BATCH, cfg.ALPHA, cfg.BETA);
+    l.push[0] = mg;
+    l.gx = ceil_div(cfg.N, g.TN);
+    l.gy = ceil_div(mg, g.TM);
+    l.gz = cfg.BATCH;
+    l.flops = 2.0 * double(cfg.M) * double(cfg.N) * double(cfg.K) * double(cfg.BATCH);
+    l.wall = cfg.WALL;
+    const bool unfused = g.epi && !g.fused;
+    Launch::Pass elem;
+    elem.gx = ceil_div(cfg.N, 64); elem.gy = mg; elem.gz = cfg.BATCH;
+    if (l.push[7] > 1) {
+        l.dset = g.packb ? S.split_p : S.split;
+        l.gz = cfg.BATCH * l.push[7];
+        Launch::Pass red = elem;
+        red.pipe = (g.epi && g.fused) ? S.epi_pipe : S.reduce_pipe;
+        red.dset = unfused ? S.reduce_t : S.reduce;
+        red.push = l.push;
+        l.post.push_back(red);
+    } else if (unfused) {
+        l.dset = g.packb ? S.to_t_p : S.to_t;
+    }
+    if (unfused) {
+        elem.pipe = S.epi_pipe; elem.dset = S.epi;
+        elem.push = l.push;
+        elem.push[6] = cfg.K; elem.push[7] = 1; elem.push[11] = 0;
+        l.post.push_back(elem);
+    }
+    if (mg < cfg.M) {
+        const float* hA = (const float*)C.bufA.map + (size_t)mg * cfg.K;
+        const float* hB = (const float*)C.bufB.map;
+        const float* bias = (const float*)C.bufBias.map;
+        float* hC = (float*)C.bufC.map + (size_t)mg * cfg.N;
+        const uint32_t mc = cfg.M - mg, N = cfg.N, K = cfg.K, batch = cfg.BATCH, threads = cfg.CPU_THREADS, epi = g.epi;
+        const float alpha = cfg.ALPHA, beta = cfg.BETA;
+        // cpu_sgemm overwrites its output, so an epilogue goes through tmp
+        auto tmp = std::make_shared<std::vector<float>>(epi ? (size_t)mc * N : 0);
+        l.host = [=]{
+            for (uint32_t b=0; b<batch; b++) {
+                float* c = hC + (size_t)b * sC;
+                cpu_sgemm(mc, N, K, hA + (size_t)b * sA, K, hB + (size_t)b * sB, N, epi ? tmp->data() : c, N, threads);
+                if (!epi) continue;
+                for (size_t i=0; i<(size_t)mc * N; i++)
+                    c[i] = epilogue_ref(epi, (*tmp)[i], c[i], bias[i % N], alpha, beta);
+            }
+        };
+    }
+    return l;
+}
 
-        // timed reps
-        vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, C.qpool, 0);
-        for (uint32_t i=0;i<cfg.REP;i++) { vkCmdDispatch(cb, groupsX, groupsY, 1); }
-        vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, C.qpool, 1);
+// Time-sliced execution: the WARM+REP dispatches go out in small command
+// buffers, each with its own fence, sized to roughly SLICE_MS of GPU time from
+// the per-dispatch estimate of the chunks so far (the first chunk is a single
+// dispatch, chunks are capped at kMaxChunk). Every dispatch sits between its
+// own timestamp pair, with a compute->compute barrier in front so dispatches
+// never overlap and each one is timed on its own.
+// After every chunk the projected cost of the whole run is checked against
+// BUDGET_MS, so a hopeless candidate is dropped after a few seconds instead of
+// holding the GPU (and tripping driver watchdogs) until TIMEOUT_MS. Status:
+//   OK       all reps ran
+//   PARTIAL  stopped over budget; stats cover the dispatches that did run
+//            (timed reps if any, otherwise warmups)
+//   TIMEOUT / WAIT_FAIL  a single chunk did not finish
+static Meas run_candidate(TuneCtx& C, const Launch& L, const RunCfg& cfg, uint32_t warm, uint32_t rep) {
+    Meas m;
+
+    VkCommandBufferAllocateInfo cbai{VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+    cbai.commandPool = C.cpool; cbai.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY; cbai.commandBufferCount = 1;
+    VkFenceCreateInfo fci{VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+
+    VkMemoryBarrier mb{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    mb.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    mb.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+    const double budget_ns = double(cfg.BUDGET_MS) * 1e6;
+    const double slice_ns  = double(cfg.SLICE_MS) * 1e6;
+    const uint32_t total = warm + rep;
+    uint32_t done = 0, n = cfg.CHUNK ? cfg.CHUNK : 1u;
+    double gpu_ns = 0.0, host_sum = 0.0, dev_sum = 0.0;
+    std::vector<double> warm_us, timed_us;
+    std::vector<uint64_t> t(2 * kMaxChunk);
+    const bool wall = L.host || L.wall;
+
+    while (done < total) {
+        // never straddle the warmup/timed boundary; hybrid syncs with the CPU every
+        // dispatch, and wall clock timing covers one dispatch per submit
+        uint32_t phase_left = (done < warm) ? warm - done : total - done;
+        n = wall ? 1u : std::max(1u, std::min({n, phase_left, kMaxChunk}));
 
+        VkCommandBuffer cb; VK_CHECK(vkAllocateCommandBuffers(C.device, &cbai, &cb));
+        VkCommandBufferBeginInfo cbi{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+        cbi.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        VK_CHECK(vkBeginCommandBuffer(cb, &cbi));
+        vkCmdResetQueryPool(cb, C.qpool, 0, 2*n);
+        auto bind = [&](VkPipeline p, VkDescriptorSet ds, const std::vector<uint32_t>& push){
+            vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, p);
+            vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, L.layout, 0, 1, &ds, 0, nullptr);
+            vkCmdPushConstants(cb, L.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, uint32_t(push.size() * 4), push.data());
+        };
+        auto barrier = [&]{
+            vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 0, 1, &mb, 0, nullptr, 0, nullptr);
+        };
+        bind(L.pipe, L.dset, L.push);
+        for (uint32_t i=0;i<n;i++) {
+            if (i) barrier();
+            if (i && !L.post.empty()) bind(L.pipe, L.dset, L.push);
+            vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, C.qpool, 2*i);
+            vkCmdDispatch(cb, L.gx, L.gy, L.gz);
+            for (const Launch::Pass& p : L.post) {
+                barrier();
+                bind(p.pipe, p.dset, p.push);
+                vkCmdDispatch(cb, p.gx, p.gy, p.gz);
+            }
+            vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, C.qpool, 2*i+1);
+        }
         VK_CHECK(vkEndCommandBuffer(cb));
 
-        // Submit & wait with timeout
-        VkFenceCreateInfo fci{VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
         VkFence fence; VK_CHECK(vkCreateFence(C.device, &fci, nullptr, &fence));
         VkSubmitInfo si2{VK_STRUCTURE_TYPE_SUBMIT_INFO};
         si2.commandBufferCount = 1; si2.pCommandBuffers = &cb;
+        auto w0 = std::chrono::steady_clock::now();
         VK_CHECK(vkQueueSubmit(C.queue, 1, &si2, fence));
+        double host_ns = 0.0;
+        if (L.host) {
+            auto h0 = std::chrono::steady_clock::now();
+            L.host();
+            host_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - h0).count();
+        }
         VkResult wres = vkWaitForFences(C.device, 1, &fence, VK_TRUE, cfg.TIMEOUT_MS*1000000ull);
-        if (wres == VK_TIMEOUT) {
-            fprintf(stdout, "  -> [TIMEOUT] after %llu ms (skipping result)\n", (unsigned long long)cfg.TIMEOUT_MS);
-            if (csv) fprintf(csv, "%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,TIMEOUT,0.0,0.0\n",
-                g.TM,g.TN,g.TK,g.lszx,g.lszy,g.smem,cfg.M,cfg.N,cfg.K,cfg.WARM,cfg.REP);
-            vkDestroyFence(C.device, fence, nullptr);
-            vkFreeCommandBuffers(C.device, C.cpool, 1, &cb);
-            vkDestroyPipeline(C.device, pipe, nullptr);
-            continue;
-        } else if (wres != VK_SUCCESS) {
-            fprintf(stdout, "  -> [WAIT_FAIL] err=%d\n", wres);
-            if (csv) fprintf(csv, "%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,WAIT_FAIL,0.0,0.0\n",
-                g.TM,g.TN,g.TK,g.lszx,g.lszy,g.smem,cfg.M,cfg.N,cfg.K,cfg.WARM,cfg.REP);
-            vkDestroyFence(C.device, fence, nullptr);
-            vkFreeCommandBuffers(C.device, C.cpool, 1, &cb);
-            vkDestroyPipeline(C.device, pipe, nullptr);
-            continue;
+        double wall_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - w0).count();
+        if (wres == VK_SUCCESS)
+            VK_CHECK(vkGetQueryPoolResults(C.device, C.qpool, 0, 2*n, 2*n*sizeof(uint64_t), t.data(), sizeof(uint64_t),
+                    VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+        vkDestroyFence(C.device, fence, nullptr);
+        vkFreeCommandBuffers(C.device, C.cpool, 1, &cb);
+        if (wres == VK_TIMEOUT) { m.status = "TIMEOUT"; break; }
+        if (wres != VK_SUCCESS) { fprintf(stdout, "  -> wait err=%d\n", wres); m.status = "WAIT_FAIL"; break; }
+
+        double chunk_ns = 0.0;
+        auto& dst = (done >= warm) ? timed_us : warm_us;
+        for (uint32_t i=0;i<n;i++) {
+            double ns = double(t[2*i+1] - t[2*i]) * C.timestamp_period_ns;
+            if (L.host && done >= warm) { host_sum += host_ns; dev_sum += ns; }
+            if (wall) ns = wall_ns;
+            dst.push_back(ns / 1000.0);
+            chunk_ns += ns;
         }
+        gpu_ns += chunk_ns;
+        done += n;
+        double per_disp_ns = chunk_ns / double(n);
+
+        // Project the whole run from the latest chunk and give up early
+        if (done < total && gpu_ns + double(total - done) * per_disp_ns > budget_ns) {
+            fprintf(stdout, "  -> over budget: %.1f ms/dispatch, projected %.1f s > %.1f s (%u/%u dispatches run)\n",
+                per_disp_ns / 1e6, (gpu_ns + double(total - done) * per_disp_ns) / 1e9, budget_ns / 1e9, done, total);
+            m.status = "PARTIAL";
+            break;
+        }
+        if (!cfg.CHUNK)
+            n = per_disp_ns > 0.0 ? (uint32_t)std::max(1.0, std::min(slice_ns / per_disp_ns, double(total))) : total;
+    }
 
-        // Read timestamps
-        uint64_t t[2]={0,0};
-        VK_CHECK(vkGetQueryPoolResults(C.device, C.qpool, 0, 2, sizeof(t), t, sizeof(uint64_t),
-                VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
-
-        double elapsed_ns = double(t[1]-t[0]) * C.timestamp_period_ns;
-        double usec_per_iter = (elapsed_ns / 1000.0) / double(cfg.REP);
+    // A timeout after some chunks finished still leaves a usable (partial) timing
+    if (m.status == "TIMEOUT" && done) m.status = "PARTIAL";
+    if (m.status != "OK" && m.status != "PARTIAL") return m;
 
+    // Stats over timed reps; a PARTIAL run with no timed reps falls back to the warmups
+    m.reps_done = (uint32_t)timed_us.size();
+    m.usec = compute_stats(timed_us.empty() ? warm_us : timed_us, cfg.OUTLIER_K, m.st);
+    if (L.host && m.reps_done) {
+        m.cpu_usec = host_sum / 1e3 / m.reps_done;
+        m.gpu_usec = dev_sum / 1e3 / m.reps_done;
+    }
+    if (m.usec > 0.0) {
         // GFLOPs = (2*M*N*K) / time (us->s)
-        double flops = 2.0 * double(cfg.M) * double(cfg.N) * double(cfg.K);
-        double gflops = flops / (usec_per_iter * 1e3);
+        m.gflops = L.flops / (m.usec * 1e3);
+        m.gbps = L.bytes / (m.usec * 1e3);
+    }
+    return m;
+}
+
+// run_candidate, repeated up to CV_RETRIES times while the per-dispatch
+// coefficient of variation is above CV_MAX; the least noisy run is kept.
+static Meas measure(TuneCtx& C, const Launch& L, const RunCfg& cfg, uint32_t warm, uint32_t rep) {
+    Meas best = run_candidate(C, L, cfg, warm, rep);
+    for (uint32_t r=0; r<cfg.CV_RETRIES && best.status == "OK" && best.st.cv > cfg.CV_MAX; r++) {
+        fprintf(stdout, "  -> noisy (CV=%.3f > %.3f), re-running %u/%u\n", best.st.cv, cfg.CV_MAX, r+1, cfg.CV_RETRIES);
+        Meas m = run_candidate(C, L, cfg, warm, rep);
+        if (m.status == "OK" && m.st.cv < best.st.cv) best = m;
+    }
+    return best;
+}
+
+static void compute_barrier(VkCommandBuffer cb) {
+    VkMemoryBarrier mb{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    mb.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    mb.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0, 1, &mb, 0, nullptr, 0, nullptr);
+}
+
+// One GEMM of L (no host share) with its passes behind barriers
+static void record_launch(VkCommandBuffer cb, const Launch& L) {
+    auto dispatch = [&](VkPipeline p, VkDescriptorSet ds, const std::vector<uint32_t>& push, uint32_t gx, uint32_t gy, uint32_t gz){
+        vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, p);
+        vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, L.layout, 0, 1, &ds, 0, nullptr);
+        vkCmdPushConstants(cb, L.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, uint32_t(push.size() * 4), push.data());
+        vkCmdDispatch(cb, gx, gy, gz);
+    };
+    dispatch(L.pipe, L.dset, L.push, L.gx, L.gy, L.gz);
+    for (const Launch::Pass& p : L.post) {
+        compute_barrier(cb);
+        dispatch(p.pipe, p.dset, p.push, p.gx, p.gy, p.gz);
+    }
+}
 
-        printf("  -> [OK] TM=%u TN=%u TK=%u lsz=(%u,%u) smem=%u  usec=%.3f  GFLOP/s=%.6f\n",
-            g.TM,g.TN,g.TK,g.lszx,g.lszy,g.smem, usec_per_iter, gflops);
-        if (csv) fprintf(csv, "%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,OK,%.6f,%.6f\n",
-            g.TM,g.TN,g.TK,g.lszx,g.lszy,g.smem,cfg.M,cfg.N,cfg.K,cfg.WARM,cfg.REP, usec_per_iter, gflops);
+// Latency mode (--latency): host wall time from vkQueueSubmit until the fence
+// wait returns, per matmul of a decode step, with the step issued four ways:
+//   percall  allocate, record, submit, wait on and free a command buffer and
+//            fence per matmul (how run_candidate and a naive loop work)
+//   reuse    one command buffer and fence for all calls, reset and re-recorded
+//            with each matmul's push constants
+//   replay   a command buffer per matmul of the step recorded once and only
+//            resubmitted (shapes and buffers fixed across tokens)
+//   chain    the whole step in one command buffer behind barriers, one submit
+//            and one wait
+// The step runs WARM untimed then `steps` timed times per style; results are
+// median usec per matmul (chain: per step / matmuls in it). A wait past
+// TIMEOUT_MS abandons the rest with status TIMEOUT / WAIT_FAIL.
+struct LatRes { std::string status = "OK"; double percall = 0.0, reuse = 0.0, replay = 0.0, chain = 0.0; };
+static LatRes measure_latency(TuneCtx& C, const std::vector<Launch>& step, const RunCfg& cfg, uint32_t steps) {
+    LatRes r;
+    if (step.empty() || !steps) return r;
+    VkCommandPoolCreateInfo pci{VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+    pci.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    pci.queueFamilyIndex = C.qfam;
+    VkCommandPool pool; VK_CHECK(vkCreateCommandPool(C.device, &pci, nullptr, &pool));
+    VkCommandBufferAllocateInfo cbai{VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+    cbai.commandPool = pool; cbai.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY; cbai.commandBufferCount = 1;
+    VkFenceCreateInfo fci{VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+    VkFence fence; VK_CHECK(vkCreateFence(C.device, &fci, nullptr, &fence));
 
-        // cleanup command resources
+    auto begin = [](VkCommandBuffer cb, VkCommandBufferUsageFlags flags){
+        VkCommandBufferBeginInfo cbi{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+        cbi.flags = flags;
+        VK_CHECK(vkBeginCommandBuffer(cb, &cbi));
+    };
+    bool ok = true;
+    auto submit = [&](VkCommandBuffer cb, VkFence f){
+        VkSubmitInfo si{VK_STRUCTURE_TYPE_SUBMIT_INFO};
+        si.commandBufferCount = 1; si.pCommandBuffers = &cb;
+        VK_CHECK(vkQueueSubmit(C.queue, 1, &si, f));
+        VkResult wres = vkWaitForFences(C.device, 1, &f, VK_TRUE, cfg.TIMEOUT_MS*1000000ull);
+        if (wres == VK_TIMEOUT) r.status = "TIMEOUT";
+        else if (wres != VK_SUCCESS) { fprintf(stdout, "  -> wait err=%d\n", wres); r.status = "WAIT_FAIL"; }
+        ok = wres == VK_SUCCESS;
+    };
+    // The pool takes every command buffer still allocated with it
+    auto finish = [&]{
         vkDestroyFence(C.device, fence, nullptr);
-        vkFreeCommandBuffers(C.device, C.cpool, 1, &cb);
-        vkDestroyPipeline(C.device, pipe, nullptr);
+        vkDestroyCommandPool(C.device, pool, nullptr);
+        return r;
+    };
+    using clk = std::chrono::steady_clock;
+    auto us_since = [](clk::time_point t0){ return std::chrono::duration<double, std::micro>(clk::now() - t0).count(); };
+    const uint32_t total = cfg.WARM + steps;
+    Stats st;
+    std::vector<double> v;
+    auto median = [&]{ compute_stats(v, cfg.OUTLIER_K, st); v.clear(); return st.median; };
+
+    for (uint32_t it=0; ok && it<total; it++)
+        for (const Launch& L : step) {
+            auto t0 = clk::now();
+            VkCommandBuffer cb; VK_CHECK(vkAllocateCommandBuffers(C.device, &cbai, &cb));
+            begin(cb, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+            record_launch(cb, L);
+            VK_CHECK(vkEndCommandBuffer(cb));
+            VkFence f; VK_CHECK(vkCreateFence(C.device, &fci, nullptr, &f));
+            submit(cb, f);
+            vkDestroyFence(C.device, f, nullptr);
+            vkFreeCommandBuffers(C.device, pool, 1, &cb);
+            if (!ok) break;
+            if (it >= cfg.WARM) v.push_back(us_since(t0));
+        }
+    r.percall = median();
+    if (!ok) return finish();
+
+    VkCommandBuffer one; VK_CHECK(vkAllocateCommandBuffers(C.device, &cbai, &one));
+    for (uint32_t it=0; ok && it<total; it++)
+        for (const Launch& L : step) {
+            auto t0 = clk::now();
+            VK_CHECK(vkResetCommandBuffer(one, 0));
+            begin(one, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+            record_launch(one, L);
+            VK_CHECK(vkEndCommandBuffer(one));
+            VK_CHECK(vkResetFences(C.device, 1, &fence));
+            submit(one, fence);
+            if (!ok) break;
+            if (it >= cfg.WARM) v.push_back(us_since(t0));
+        }
+    r.reuse = median();
+    if (!ok) return finish();
+
+    std::vector<VkCommandBuffer> cbs(step.size());
+    cbai.commandBufferCount = (uint32_t)cbs.size();
+    VK_CHECK(vkAllocateCommandBuffers(C.device, &cbai, cbs.data()));
+    for (size_t i=0; i<step.size(); i++) {
+        begin(cbs[i], 0);
+        record_launch(cbs[i], step[i]);
+        VK_CHECK(vkEndCommandBuffer(cbs[i]));
+    }
+    for (uint32_t it=0; ok && it<total; it++)
+        for (VkCommandBuffer cb : cbs) {
+            auto t0 = clk::now();
+            VK_CHECK(vkResetFences(C.device, 1, &fence));
+            submit(cb, fence);
+            if (!ok) break;
+            if (it >= cfg.WARM) v.push_back(us_since(t0));
+        }
+    r.replay = median();
+    if (!ok) return finish();
+
+    VK_CHECK(vkResetCommandBuffer(one, 0));
+    begin(one, 0);
+    for (size_t i=0; i<step.size(); i++) {
+        if (i) compute_barrier(one);
+        record_launch(one, step[i]);
+    }
+    VK_CHECK(vkEndCommandBuffer(one));
+    for (uint32_t it=0; it<total; it++) {
+        auto t0 = clk::now();
+        VK_CHECK(vkResetFences(C.device, 1, &fence));
+        submit(one, fence);
+        if (!ok) break;
+        if (it >= cfg.WARM) v.push_back(us_since(t0) / double(step.size()));
+    }
+    r.chain = median();
+    return finish();
+}
+
+// Throughput mode (--streams=): independent GEMM streams, each with its own
+// A/B/C (bias is shared, read only), descriptor set, timeline semaphore and a
+// prerecorded command buffer, spread round-robin over C.queues (on a device
+// with one queue they are separate submissions to it). Buffers are sized for
+// the largest shape once; A and B hold 1.0f.
+struct Streams {
+    MemArena arena;
+    std::vector<GpuBuf> A, B, C;
+    VkDescriptorPool dpool = VK_NULL_HANDLE;
+    std::vector<VkDescriptorSet> sets;
+    std::vector<VkSemaphore> sems;
+    std::vector<uint64_t> val;          // last value signalled per stream
+    VkCommandPool cpool = VK_NULL_HANDLE;
+};
+
+static Streams create_streams(TuneCtx& C, const RunCfg& cfg, uint32_t n, size_t sizeA, size_t sizeB, size_t sizeC) {
+    Streams S;
+    S.A.resize(n); S.B.resize(n); S.C.resize(n);
+    std::vector<GpuBuf*> bufs;
+    for (uint32_t s=0; s<n; s++) {
+        S.A[s].size = sizeA; S.B[s].size = sizeB; S.C[s].size = sizeC;
+        bufs.insert(bufs.end(), {&S.A[s], &S.B[s], &S.C[s]});
+    }
+    S.arena = create_arena(C, cfg.MEM, bufs);
+    for (uint32_t s=0; s<n; s++) {
+        gpu_fill(C, S.arena, S.A[s], 0x3f800000u, sizeA);
+        gpu_fill(C, S.arena, S.B[s], 0x3f800000u, sizeB);
+    }
+
+    VkDescriptorPoolSize dps{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4 * n};
+    VkDescriptorPoolCreateInfo dpci{VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+    dpci.maxSets = n; dpci.poolSizeCount = 1; dpci.pPoolSizes = &dps;
+    VK_CHECK(vkCreateDescriptorPool(C.device, &dpci, nullptr, &S.dpool));
+    std::vector<VkDescriptorSetLayout> layouts(n, C.dsl);
+    VkDescriptorSetAllocateInfo dsai{VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+    dsai.descriptorPool = S.dpool; dsai.descriptorSetCount = n; dsai.pSetLayouts = layouts.data();
+    S.sets.resize(n);
+    VK_CHECK(vkAllocateDescriptorSets(C.device, &dsai, S.sets.data()));
+    for (uint32_t s=0; s<n; s++) {
+        VkDescriptorBufferInfo bi[4] = {{S.A[s].buf, 0, sizeA}, {S.B[s].buf, 0, sizeB}, {S.C[s].buf, 0, sizeC}, {C.bufBias.buf, 0, C.bufBias.size}};
+        VkWriteDescriptorSet w[4]{};
+        for (int i=0;i<4;i++){ w[i].sType=VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET; w[i].dstSet=S.sets[s]; w[i].dstBinding=i; w[i].descriptorCount=1; w[i].descriptorType=VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; w[i].pBufferInfo=&bi[i]; }
+        vkUpdateDescriptorSets(C.device, 4, w, 0, nullptr);
+    }
+
+    VkSemaphoreTypeCreateInfo stci{VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO};
+    stci.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    VkSemaphoreCreateInfo sci{VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
+    sci.pNext = &stci;
+    S.sems.resize(n); S.val.assign(n, 0);
+    for (VkSemaphore& sem : S.sems) VK_CHECK(vkCreateSemaphore(C.device, &sci, nullptr, &sem));
+
+    VkCommandPoolCreateInfo pci{VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+    pci.queueFamilyIndex = C.qfam;
+    VK_CHECK(vkCreateCommandPool(C.device, &pci, nullptr, &S.cpool));
+    return S;
+}
+
+static void destroy_streams(TuneCtx& C, Streams& S) {
+    vkDestroyCommandPool(C.device, S.cpool, nullptr);
+    for (VkSemaphore sem : S.sems) vkDestroySemaphore(C.device, sem, nullptr);
+    vkDestroyDescriptorPool(C.device, S.dpool, nullptr);
+    std::vector<GpuBuf*> bufs;
+    for (size_t s=0; s<S.A.size(); s++) bufs.insert(bufs.end(), {&S.A[s], &S.B[s], &S.C[s]});
+    destroy_arena(C, S.arena, bufs);
+    S = Streams{};
+}
+
+// `n` streams each keep one GEMM of L in flight, resubmitted as soon as the
+// host sees it finish, the way concurrent requests reach a server: WARM calls
+// per stream untimed, then `calls` timed. gflops is the aggregate over the
+// timed wall time; latencies are submit to completion seen on the host.
+// L must be a single GPU dispatch (no passes, no host share). A wait that
+// runs past TIMEOUT_MS ends the measurement with status TIMEOUT / WAIT_FAIL.
+struct StreamRes { std::string status = "OK"; double gflops = 0.0, p50 = 0.0, p95 = 0.0, p99 = 0.0; };
+static StreamRes measure_streams(TuneCtx& C, Streams& S, const Launch& L, uint32_t n, const RunCfg& cfg, uint32_t calls) {
+    StreamRes r;
+    std::vector<VkCommandBuffer> cbs(n);
+    VkCommandBufferAllocateInfo cbai{VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+    cbai.commandPool = S.cpool; cbai.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY; cbai.commandBufferCount = n;
+    VK_CHECK(vkAllocateCommandBuffers(C.device, &cbai, cbs.data()));
+    for (uint32_t s=0; s<n; s++) {
+        Launch Ls = L;
+        Ls.dset = S.sets[s];
+        VkCommandBufferBeginInfo cbi{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+        VK_CHECK(vkBeginCommandBuffer(cbs[s], &cbi));
+        record_launch(cbs[s], Ls);
+        VK_CHECK(vkEndCommandBuffer(cbs[s]));
+    }
+
+    using clk = std::chrono::steady_clock;
+    std::vector<clk::time_point> t_sub(n);
+    auto submit = [&](uint32_t s){
+        const uint64_t v = ++S.val[s];
+        VkTimelineSemaphoreSubmitInfo ts{VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO};
+        ts.signalSemaphoreValueCount = 1; ts.pSignalSemaphoreValues = &v;
+        VkSubmitInfo si{VK_STRUCTURE_TYPE_SUBMIT_INFO};
+        si.pNext = &ts;
+        si.commandBufferCount = 1; si.pCommandBuffers = &cbs[s];
+        si.signalSemaphoreCount = 1; si.pSignalSemaphores = &S.sems[s];
+        t_sub[s] = clk::now();
+        VK_CHECK(vkQueueSubmit(C.queues[s % C.queues.size()], 1, &si, VK_NULL_HANDLE));
+    };
+    // Runs `per` calls on every stream; latencies in usec into lat if given
+    auto run = [&](uint32_t per, std::vector<double>* lat) -> bool {
+        std::vector<uint32_t> left(n, per);
+        std::vector<VkSemaphore> wsem; std::vector<uint64_t> wval;
+        for (uint32_t s=0; s<n; s++) if (left[s]) { submit(s); left[s]--; }
+        for (;;) {
+            wsem.clear(); wval.clear();
+            for (uint32_t s=0; s<n; s++) {
+                if (t_sub[s] == clk::time_point{}) continue;
+                uint64_t v = 0;
+                VK_CHECK(vkGetSemaphoreCounterValue(C.device, S.sems[s], &v));
+                if (v >= S.val[s]) {
+                    if (lat) lat->push_back(std::chrono::duration<double, std::micro>(clk::now() - t_sub[s]).count());
+                    t_sub[s] = clk::time_point{};
+                    if (!left[s]) continue;
+                    submit(s); left[s]--;
+                }
+                wsem.push_back(S.sems[s]); wval.push_back(S.val[s]);
+            }
+            if (wsem.empty()) return true;
+            VkSemaphoreWaitInfo wi{VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO};
+            wi.flags = VK_SEMAPHORE_WAIT_ANY_BIT;
+            wi.semaphoreCount = (uint32_t)wsem.size(); wi.pSemaphores = wsem.data(); wi.pValues = wval.data();
+            VkResult wres = vkWaitSemaphores(C.device, &wi, cfg.TIMEOUT_MS*1000000ull);
+            if (wres == VK_TIMEOUT) { r.status = "TIMEOUT"; return false; }
+            if (wres != VK_SUCCESS) { fprintf(stdout, "  -> wait err=%d\n", wres); r.status = "WAIT_FAIL"; return false; }
+        }
+    };
+    // After a failed wait calls may still be in flight: let every queue used
+    // drain before their command buffers are freed and the caller destroys the
+    // pipeline or submits on the same semaphores again
+    auto fail = [&](){
+        for (size_t q=0; q<std::min<size_t>(n, C.queues.size()); q++) vkQueueWaitIdle(C.queues[q]);
+        vkFreeCommandBuffers(C.device, S.cpool, n, cbs.data());
+        return r;
+    };
+    if (!run(cfg.WARM, nullptr)) return fail();
+    std::vector<double> lat;
+    auto t0 = clk::now();
+    if (!run(calls, &lat)) return fail();
+    const double wall_us = std::chrono::duration<double, std::micro>(clk::now() - t0).count();
+    vkFreeCommandBuffers(C.device, S.cpool, n, cbs.data());
+
+    if (lat.empty() || wall_us <= 0.0) return r;
+    std::sort(lat.begin(), lat.end());
+    r.p50 = percentile(lat, 0.50); r.p95 = percentile(lat, 0.95); r.p99 = percentile(lat, 0.99);
+    r.gflops = L.flops * double(lat.size()) / (wall_us * 1e3);
+    return r;
+}
+
+// Achievable streaming bandwidth of the --mem placement: copy, read and write
+// passes of shaders/bandwidth.comp over two `mib` MiB buffers of their own.
+// Returns the best of the three in GB/s, the memory roof (0 if none ran).
+static double measure_bandwidth(TuneCtx& C, const RunCfg& cfg, uint32_t mib) {
+    if (!mib) return 0.0;
+    GpuBuf src, dst;
+    src.size = dst.size = (VkDeviceSize)mib << 20;
+    std::vector<GpuBuf*> bufs{&src, &dst};
+    MemArena arena = create_arena(C, cfg.MEM, bufs);
+    gpu_fill(C, arena, src, 0x3f800000u, src.size);
+    VkShaderModule mod = make_shader(C.device, load_spirv("shaders/bandwidth.spv"));
+
+    // Bindings 0 (src) and 2 (dst) of the GEMM layout; 1 and 3 are unused
+    VkDescriptorSetAllocateInfo dsai{VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+    dsai.descriptorPool = C.dpool; dsai.descriptorSetCount = 1; dsai.pSetLayouts = &C.dsl;
+    VkDescriptorSet dset; VK_CHECK(vkAllocateDescriptorSets(C.device, &dsai, &dset));
+    VkDescriptorBufferInfo bi[2] = {{src.buf, 0, src.size}, {dst.buf, 0, dst.size}};
+    VkWriteDescriptorSet w[2]{};
+    for (int i=0;i<2;i++){ w[i].sType=VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET; w[i].dstSet=dset; w[i].dstBinding=2*i; w[i].descriptorCount=1; w[i].descriptorType=VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; w[i].pBufferInfo=&bi[i]; }
+    vkUpdateDescriptorSets(C.device, 2, w, 0, nullptr);
+
+    const uint32_t n = uint32_t(src.size / 16);   // vec4s
+    const char* names[3] = {"copy", "read", "write"};
+    double best = 0.0;
+    fprintf(stderr, "# bandwidth (%s@%s, 2 x %u MiB):", mem_place_name(cfg.MEM), mem_type_desc(arena).c_str(), mib);
+    for (uint32_t mode=0; mode<3; mode++) {
+        VkSpecializationMapEntry me{1, 0, sizeof(uint32_t)};
+        VkSpecializationInfo si{}; si.mapEntryCount=1; si.pMapEntries=&me; si.dataSize=sizeof(mode); si.pData=&mode;
+        VkComputePipelineCreateInfo pci{VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+        pci.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pci.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT; pci.stage.module = mod; pci.stage.pName = "main";
+        pci.stage.pSpecializationInfo = &si;
+        pci.layout = C.ppl;
+        Launch L;
+        VK_CHECK(vkCreateComputePipelines(C.device, VK_NULL_HANDLE, 1, &pci, nullptr, &L.pipe));
+        L.layout = C.ppl; L.dset = dset;
+        L.push = { n };
+        L.gx = std::min(ceil_div(n, 256), C.props.limits.maxComputeWorkGroupCount[0]);
+        L.bytes = double(src.size) * (mode == 0 ? 2.0 : 1.0);
+        Meas m = run_candidate(C, L, cfg, 2, 10);
+        if (m.status == "OK") { fprintf(stderr, "  %s %.2f GB/s", names[mode], m.gbps); best = std::max(best, m.gbps); }
+        else fprintf(stderr, "  %s %s", names[mode], m.status.c_str());
+        vkDestroyPipeline(C.device, L.pipe, nullptr);
+    }
+    fprintf(stderr, "\n");
+    vkDestroyShaderModule(C.device, mod, nullptr);
+    destroy_arena(C, arena, bufs);
+    return best;
+}
+
+// ---------------------------------------------------------------------------
+// Verification against the CPU reference
+// ---------------------------------------------------------------------------
+struct VerifyRes { size_t bad = 0; double max_abs = 0.0, max_rel = 0.0; uint32_t max_ulp = 0; };
+
+// Distance in representable floats (sign-magnitude mapped onto one integer line)
+static uint32_t ulp_diff(float a, float b) {
+    int32_t ia, ib; std::memcpy(&ia, &a, 4); std::memcpy(&ib, &b, 4);
+    if (ia < 0) ia = INT32_MIN - ia;
+    if (ib < 0) ib = INT32_MIN - ib;
+    int64_t d = (int64_t)ia - (int64_t)ib;
+    return (uint32_t)std::min<int64_t>(d < 0 ? -d : d, UINT32_MAX);
+}
+
+// An element passes when it is within `ulp` ULPs or |c - r| <= rtol*|r| + atol.
+// NaN/Inf (e.g. tiles the kernel never wrote) always fail.
+static VerifyRes verify_c(const float* C, const float* R, size_t n, double rtol, double atol, uint32_t ulp) {
+    VerifyRes v;
+    for (size_t i=0;i<n;i++) {
+        float c = C[i], r = R[i];
+        if (!std::isfinite(c)) { v.bad++; v.max_abs = INFINITY; v.max_ulp = UINT32_MAX; continue; }
+        double ad = std::fabs(double(c) - double(r));
+        uint32_t u = ulp_diff(c, r);
+        v.max_abs = std::max(v.max_abs, ad);
+        if (r != 0.0f) v.max_rel = std::max(v.max_rel, ad / std::fabs(double(r)));
+        v.max_ulp = std::max(v.max_ulp, u);
+        if (u > ulp && ad > rtol * std::fabs(double(r)) + atol) v.bad++;
+    }
+    return v;
+}
+
+// ---------------------------------------------------------------------------
+// Multi-shape summary
+// ---------------------------------------------------------------------------
+static std::string shape_label(const Shape& sh) {
+    char buf[64];
+    int n = snprintf(buf, sizeof(buf), "%ux%ux%u", sh.M, sh.N, sh.K);
+    if (sh.batch > 1) snprintf(buf + n, sizeof(buf) - n, "*%u", sh.batch);
+    return sh.name.empty() ? std::string(buf) : sh.name + " " + buf;
+}
+
+// Per-shape winner table, plus an l/m/s_warptile block in the format of
+// vulkan-low-smem-optimized.patch ({ BM, BN, BK, sg, 1 }): shapes are sorted by
+// FLOPs and split into small/medium/large thirds, each getting the candidate
+// that is closest to optimal across its third. The per-shape table takes full
+// measurements only; a third also scores candidates by their estimate (est) on
+// shapes where halving pruned them or the model search never ran them.
+static void print_winners(const std::vector<Shape>& shapes, const std::vector<Cand>& grid,
+                          const ShapeTimes& med, const ShapeTimes& est, uint32_t sg, const std::string& path) {
+    FILE* tsv = path.empty() ? nullptr : fopen(path.c_str(), "w");
+    if (!path.empty() && !tsv) fprintf(stderr, "Cannot write winner table %s\n", path.c_str());
+    if (tsv) fprintf(tsv, "shape\tM\tN\tK\tbatch\tTM\tTN\tTK\tlszx\tlszy\tsmem\tusec_median\tgflops\tfamily\tvec\tdbuf\tpad\tsplitk\tepilogue\tcpu_split\tpackb\n");
+    printf("\n# winners (median)\n");
+    for (size_t s=0; s<shapes.size(); s++) {
+        const Shape& sh = shapes[s];
+        size_t gi = best_for({s}, grid.size(), med, nullptr).gi;
+        if (gi == grid.size()) { printf("#   %-28s  (no valid candidate)\n", shape_label(sh).c_str()); continue; }
+        const Cand& g = grid[gi];
+        double gf = 2.0 * double(sh.M) * double(sh.N) * double(sh.K) * double(sh.batch) / (med[s][gi] * 1e3);
+        printf("#   %-28s  %s  median=%.3f usec  GFLOP/s=%.3f\n",
+            shape_label(sh).c_str(), cand_str(g).c_str(), med[s][gi], gf);
+        if (tsv) fprintf(tsv, "%s\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%.6f\t%.6f\tv%u\t%u\t%u\t%u\t%u\t%s\t%u\t%u\n",
+            sh.name.c_str(), sh.M,sh.N,sh.K,sh.batch, g.TM,g.TN,g.TK,g.lszx,g.lszy,g.smem, med[s][gi], gf, g.fam + 1, g.vec, g.dbuf, g.pad, g.splitk,
+            epilogue_col(g).c_str(), g.cpu, g.packb);
+    }
+    if (tsv) fclose(tsv);
+
+    std::vector<size_t> order(shapes.size());
+    for (size_t i=0;i<order.size();i++) order[i] = i;
+    auto flops = [&](size_t i){ return double(shapes[i].M) * shapes[i].N * shapes[i].K * shapes[i].batch; };
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b){ return flops(a) < flops(b); });
+    const char* tier[3] = {"s", "m", "l"};
+    GroupPick pick[3];
+    for (int t=0; t<3; t++) {
+        size_t lo = order.size() * t / 3, hi = std::max(lo + 1, order.size() * (t + 1) / 3);
+        std::vector<size_t> set(order.begin() + std::min(lo, order.size() - 1), order.begin() + std::min(hi, order.size()));
+        pick[t] = best_for(set, grid.size(), med, &est);
+        if (pick[t].gi == grid.size()) { printf("# warptile: no candidate is valid on every %s shape\n", tier[t]); return; }
+    }
+    printf("\n# warptile block (paste into ggml-vulkan.cpp, low-SMEM branch)\n");
+    printf("            const uint32_t sg = subgroup_size_8; // %u on this device\n\n", sg);
+    for (int t=2; t>=0; t--) {
+        const Cand& g = grid[pick[t].gi];
+        printf("            %s_warptile = { %3u, %3u, %2u, sg, 1 }; // lsz=%ux%u smem=%u, %.2fx of per-shape best%s%s%s%s%s\n",
+            tier[t], g.TM, g.TN, g.TK, g.lszx, g.lszy, g.smem, pick[t].slowdown, g.fam ? " (measured with gemm_v2)" : "",
+            g.splitk > 1 ? (" (split_k=" + std::to_string(g.splitk) + ")").c_str() : "",
+            g.cpu ? (" (cpu_split=" + std::to_string(g.cpu) + "%)").c_str() : "",
+            g.packb ? " (packed B)" : "",
+            pick[t].estimated ? (" (estimated on " + std::to_string(pick[t].estimated) + " shape" + (pick[t].estimated > 1 ? "s)" : ")")).c_str() : "");
+    }
+    for (int t=2; t>=0; t--) {
+        const Cand& g = grid[pick[t].gi];
+        printf("            %s_wg_denoms = { %3u, %3u, 1 };\n", tier[t], g.TM, g.TN);
+    }
+    printf("\n");
+    for (int t=2; t>=0; t--) {
+        const Cand& g = grid[pick[t].gi];
+        printf("            %s_warptile_mmq = { %3u, %3u, %2u, sg, 1 };\n", tier[t], g.TM, g.TN, g.TK);
+    }
+    for (int t=2; t>=0; t--) {
+        const Cand& g = grid[pick[t].gi];
+        printf("            %s_mmq_wg_denoms = { %3u, %3u, 1 };\n", tier[t], g.TM, g.TN);
+    }
+    fflush(stdout);
+}
+
+// ---------------------------------------------------------------------------
+// Out-of-core GEMM (see ooc_plan)
+// ---------------------------------------------------------------------------
+// A, B and C of the whole problem stay in host memory. The panel buffers are
+// mapped and hold two slots each, bound by descriptor offset and range, so the
+// host packs the panels of step t+1 into the free slot while the GPU runs step
+// t (at most two steps in flight). A panel equal to the one already in its
+// slot is not packed again; steps are ordered so that the matrix streamed
+// more often is the smaller one. Later K blocks accumulate into the C tile
+// with the scale epilogue (beta = 1), and a finished tile is unpacked while
+// the next one computes. Plain C = A*B: the run's epilogue is not applied.
+static void run_out_of_core(TuneCtx& C, const RunCfg& cfg, const Shape& sh, const OocPlan& p, const Cand& win,
+                            const VkShaderModule* mods, VkPipelineCache cache) {
+    const std::string label = shape_label(sh);
+    const uint32_t mb = ceil_div(sh.M, p.Mt), nb = ceil_div(sh.N, p.Nt), kb = ceil_div(sh.K, p.Kt);
+    const size_t sA = (size_t)sh.M * sh.K, sB = (size_t)sh.K * sh.N, sC = (size_t)sh.M * sh.N;
+    std::vector<float> hA, hB, hC;
+    try {
+        hA.resize(sA * sh.batch); hB.resize(sB * sh.batch); hC.resize(sC * sh.batch);
+    } catch (const std::bad_alloc&) {
+        printf("# out-of-core %s: cannot allocate %.1f GiB of host matrices\n", label.c_str(),
+            double(sA + sB + sC) * sh.batch * sizeof(float) / (1 << 30));
+        return;
+    }
+    if (cfg.VERIFY) {
+        std::mt19937 rng(cfg.SEED);
+        std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+        for (float& x : hA) x = dist(rng);
+        for (float& x : hB) x = dist(rng);
+    } else {
+        std::fill(hA.begin(), hA.end(), 1.0f);
+        std::fill(hB.begin(), hB.end(), 1.0f);
+    }
+
+    // K blocks after the first: C = 1*acc + 1*C
+    Cand g0 = win; g0.epi = 0; g0.fused = 1; g0.splitk = 1; g0.cpu = 0;
+    Cand g1 = g0; g1.epi = EPI_SCALE;
+    VkPipeline pipe[2] = {};
+    if (create_pipeline(C, mods, cache, g0, &pipe[0]) != VK_SUCCESS ||
+        (kb > 1 && create_pipeline(C, mods, cache, g1, &pipe[1]) != VK_SUCCESS)) {
+        printf("# out-of-core %s: pipeline creation failed\n", label.c_str());
+        for (VkPipeline pp : pipe) if (pp) vkDestroyPipeline(C.device, pp, nullptr);
+        return;
+    }
+
+    // Two slots per panel buffer; --mem=device still needs them mapped
+    const VkDeviceSize align = std::max<VkDeviceSize>(C.props.limits.minStorageBufferOffsetAlignment, 16);
+    auto slot_bytes = [&](uint64_t elems){ return (elems * sizeof(float) + align - 1) / align * align; };
+    const VkDeviceSize slot[3] = { slot_bytes(uint64_t(p.Mt) * p.Kt), slot_bytes(uint64_t(p.Kt) * p.Nt), slot_bytes(uint64_t(p.Mt) * p.Nt) };
+    GpuBuf bA, bB, bC;
+    bA.size = 2 * slot[0]; bB.size = 2 * slot[1]; bC.size = 2 * slot[2];
+    std::vector<GpuBuf*> bufs{&bA, &bB, &bC};
+    MemArena arena = create_arena(C, cfg.MEM == MemPlace::Device ? MemPlace::Coherent : cfg.MEM, bufs);
+
+    // sets[a][b][c]: slot of each panel
+    VkDescriptorPoolSize dps{}; dps.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; dps.descriptorCount = 8*4;
+    VkDescriptorPoolCreateInfo dpci{VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+    dpci.maxSets = 8; dpci.poolSizeCount = 1; dpci.pPoolSizes = &dps;
+    VkDescriptorPool dpool; VK_CHECK(vkCreateDescriptorPool(C.device, &dpci, nullptr, &dpool));
+    VkDescriptorSet sets[2][2][2];
+    for (int i=0;i<8;i++) {
+        const int a = i >> 2, b = (i >> 1) & 1, c = i & 1;
+        VkDescriptorSetAllocateInfo dsai{VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+        dsai.descriptorPool = dpool; dsai.descriptorSetCount = 1; dsai.pSetLayouts = &C.dsl;
+        VK_CHECK(vkAllocateDescriptorSets(C.device, &dsai, &sets[a][b][c]));
+        VkDescriptorBufferInfo bi[4] = {{bA.buf, a * slot[0], slot[0]}, {bB.buf, b * slot[1], slot[1]},
+                                        {bC.buf, c * slot[2], slot[2]}, {bC.buf, c * slot[2], slot[2]}};
+        VkWriteDescriptorSet w[4]{};
+        for (int j=0;j<4;j++){ w[j].sType=VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET; w[j].dstSet=sets[a][b][c]; w[j].dstBinding=j; w[j].descriptorCount=1; w[j].descriptorType=VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; w[j].pBufferInfo=&bi[j]; }
+        vkUpdateDescriptorSets(C.device, 4, w, 0, nullptr);
+    }
+    VkCommandPoolCreateInfo cpci{VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+    cpci.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; cpci.queueFamilyIndex = C.qfam;
+    VkCommandPool cpool; VK_CHECK(vkCreateCommandPool(C.device, &cpci, nullptr, &cpool));
+    VkCommandBufferAllocateInfo cbai{VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+    cbai.commandPool = cpool; cbai.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY; cbai.commandBufferCount = 2;
+    VkCommandBuffer cbs[2]; VK_CHECK(vkAllocateCommandBuffers(C.device, &cbai, cbs));
+    VkFence fences[2];
+    VkFenceCreateInfo fci{VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+    for (VkFence& f : fences) VK_CHECK(vkCreateFence(C.device, &fci, nullptr, &f));
+
+    // Steps: i (M tiles) or j (N tiles) outermost, whichever streams fewer bytes when K is whole
+    struct Step { uint32_t b, i, j, k; uint8_t sa, sb, sc; };
+    const bool i_outer = sA + (double)mb * sB <= sB + (double)nb * sA;
+    std::vector<Step> steps;
+    steps.reserve((size_t)sh.batch * mb * nb * kb);
+    for (uint32_t b=0; b<sh.batch; b++)
+        for (uint32_t o=0; o<(i_outer ? mb : nb); o++)
+            for (uint32_t q=0; q<(i_outer ? nb : mb); q++)
+                for (uint32_t k=0; k<kb; k++)
+                    steps.push_back({b, i_outer ? o : q, i_outer ? q : o, k, 0, 0, 0});
+
+    auto rows = [](uint32_t t, uint32_t tile, uint32_t n){ return std::min(tile, n - t * tile); };
+    // Pack step t's A/B panels unless the slot in use already holds them
+    uint64_t held[2] = {UINT64_MAX, UINT64_MAX};   // A, B panel in the current slot
+    uint8_t cur[3] = {1, 1, 1};                     // current slot of A, B, C
+    double streamed = 0.0, host_s = 0.0, wait_s = 0.0, gpu_ns = 0.0;
+    auto pack = [&](size_t t){
+        auto t0 = std::chrono::steady_clock::now();
+        Step& s = steps[t];
+        const uint32_t mt = rows(s.i, p.Mt, sh.M), nt = rows(s.j, p.Nt, sh.N), kt = rows(s.k, p.Kt, sh.K);
+        const uint64_t ka = ((uint64_t(s.b) * mb + s.i) * kb + s.k), kbk = ((uint64_t(s.b) * kb + s.k) * nb + s.j);
+        if (ka != held[0]) {
+            cur[0] ^= 1; held[0] = ka;
+            float* dst = (float*)(bA.map + cur[0] * slot[0]);
+            const float* src = hA.data() + s.b * sA + (size_t)s.i * p.Mt * sh.K + (size_t)s.k * p.Kt;
+            for (uint32_t r=0; r<mt; r++) std::memcpy(dst + (size_t)r * kt, src + (size_t)r * sh.K, kt * sizeof(float));
+            streamed += double(mt) * kt * sizeof(float);
+        }
+        if (kbk != held[1]) {
+            cur[1] ^= 1; held[1] = kbk;
+            float* dst = (float*)(bB.map + cur[1] * slot[1]);
+            const float* src = hB.data() + s.b * sB + (size_t)s.k * p.Kt * sh.N + (size_t)s.j * p.Nt;
+            for (uint32_t r=0; r<kt; r++) std::memcpy(dst + (size_t)r * nt, src + (size_t)r * sh.N, nt * sizeof(float));
+            streamed += double(kt) * nt * sizeof(float);
+        }
+        if (s.k == 0) cur[2] ^= 1;
+        s.sa = cur[0]; s.sb = cur[1]; s.sc = cur[2];
+        flush_arena(C, arena);
+        host_s += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    };
+    auto submit = [&](size_t t){
+        const Step& s = steps[t];
+        const uint32_t mt = rows(s.i, p.Mt, sh.M), nt = rows(s.j, p.Nt, sh.N), kt = rows(s.k, p.Kt, sh.K);
+        VkCommandBuffer cb = cbs[t % 2];
+        VK_CHECK(vkResetFences(C.device, 1, &fences[t % 2]));
+        VK_CHECK(vkResetCommandBuffer(cb, 0));
+        VkCommandBufferBeginInfo cbi{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+        cbi.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        VK_CHECK(vkBeginCommandBuffer(cb, &cbi));
+        vkCmdResetQueryPool(cb, C.qpool, 2 * (t % 2), 2);
+        // the previous K block of this tile wrote C
+        VkMemoryBarrier mb0{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+        mb0.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT; mb0.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &mb0, 0, nullptr, 0, nullptr);
+        vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, C.qpool, 2 * (t % 2));
+        const std::vector<uint32_t> push = gemm_push(s.k ? g1 : g0, mt, nt, kt, 1, 1.0f, 1.0f);
+        vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, pipe[s.k ? 1 : 0]);
+        vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, C.ppl, 0, 1, &sets[s.sa][s.sb][s.sc], 0, nullptr);
+        vkCmdPushConstants(cb, C.ppl, VK_SHADER_STAGE_COMPUTE_BIT, 0, uint32_t(push.size() * sizeof(uint32_t)), push.data());
+        vkCmdDispatch(cb, ceil_div(nt, win.TN), ceil_div(mt, win.TM), 1);
+        vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, C.qpool, 2 * (t % 2) + 1);
+        VkMemoryBarrier mb1{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+        mb1.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT; mb1.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &mb1, 0, nullptr, 0, nullptr);
+        VK_CHECK(vkEndCommandBuffer(cb));
+        VkSubmitInfo si{VK_STRUCTURE_TYPE_SUBMIT_INFO};
+        si.commandBufferCount = 1; si.pCommandBuffers = &cb;
+        VK_CHECK(vkQueueSubmit(C.queue, 1, &si, fences[t % 2]));
+    };
+    // Wait for step t; unpack its C tile if that was the last K block
+    auto retire = [&](size_t t){
+        auto t0 = std::chrono::steady_clock::now();
+        VK_CHECK(vkWaitForFences(C.device, 1, &fences[t % 2], VK_TRUE, UINT64_MAX));
+        auto t1 = std::chrono::steady_clock::now();
+        wait_s += std::chrono::duration<double>(t1 - t0).count();
+        uint64_t ts[2] = {};
+        if (vkGetQueryPoolResults(C.device, C.qpool, 2 * (t % 2), 2, sizeof(ts), ts, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+            gpu_ns += double(ts[1] - ts[0]) * C.timestamp_period_ns;
+        const Step& s = steps[t];
+        if (s.k + 1 < kb) return;
+        const uint32_t mt = rows(s.i, p.Mt, sh.M), nt = rows(s.j, p.Nt, sh.N);
+        invalidate_arena(C, arena);
+        const float* src = (const float*)(bC.map + s.sc * slot[2]);
+        float* dst = hC.data() + s.b * sC + (size_t)s.i * p.Mt * sh.N + (size_t)s.j * p.Nt;
+        for (uint32_t r=0; r<mt; r++) std::memcpy(dst + (size_t)r * sh.N, src + (size_t)r * nt, nt * sizeof(float));
+        host_s += std::chrono::duration<double>(std::chrono::steady_clock::now() - t1).count();
+    };
+
+    const auto t0 = std::chrono::steady_clock::now();
+    pack(0);
+    for (size_t t=0; t<steps.size(); t++) {
+        submit(t);
+        if (t) retire(t - 1);
+        if (t + 1 < steps.size()) pack(t + 1);
+    }
+    retire(steps.size() - 1);
+    const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    const double flops = 2.0 * double(sh.M) * sh.N * sh.K * sh.batch;
+    printf("# out-of-core %s: %zu steps of %ux%ux%u panels (%u x %u x %u, %s outer), %s\n",
+        label.c_str(), steps.size(), p.Mt, p.Nt, p.Kt, mb, nb, kb, i_outer ? "M" : "N", cand_str(g0).c_str());
+    printf("#   %.3f s  GFLOP/s=%.3f  GPU busy %.3f s (%.0f%%)  host pack/unpack %.3f s  streamed %.1f MiB (%.2f GB/s)  waited %.3f s\n",
+        secs, flops / (secs * 1e9), gpu_ns * 1e-9, 100.0 * gpu_ns * 1e-9 / secs, host_s, streamed / (1 << 20),
+        streamed / (secs * 1e9), wait_s);
+    if (cfg.EPILOGUE) printf("#   (epilogue %s not applied out of core)\n", epilogue_name(cfg.EPILOGUE).c_str());
+    // Spot check of C against double-precision dot products
+    if (cfg.VERIFY) {
+        std::mt19937 rng(cfg.SEED + 1);
+        const double atol = cfg.VERIFY_ATOL > 0.0 ? cfg.VERIFY_ATOL : 1e-6 * double(sh.K);
+        uint32_t bad = 0, n = 256;
+        double max_abs = 0.0;
+        for (uint32_t s=0; s<n; s++) {
+            const size_t b = rng() % sh.batch, r = rng() % sh.M, c = rng() % sh.N;
+            double ref = 0.0;
+            for (uint32_t k=0; k<sh.K; k++) ref += double(hA[b * sA + r * sh.K + k]) * hB[b * sB + (size_t)k * sh.N + c];
+            const double err = std::fabs(hC[b * sC + r * sh.N + c] - ref);
+            max_abs = std::max(max_abs, err);
+            if (!(err <= atol + cfg.VERIFY_RTOL * std::fabs(ref))) bad++;
+        }
+        if (bad) printf("#   [WRONG_RESULT] %u/%u sampled elements off, max_abs=%.3g\n", bad, n, max_abs);
+        else     printf("#   verified %u sampled elements, max_abs=%.3g\n", n, max_abs);
+    }
+
+    for (VkFence f : fences) vkDestroyFence(C.device, f, nullptr);
+    vkDestroyCommandPool(C.device, cpool, nullptr);
+    vkDestroyDescriptorPool(C.device, dpool, nullptr);
+    destroy_arena(C, arena, bufs);
+    for (VkPipeline pp : pipe) if (pp) vkDestroyPipeline(C.device, pp, nullptr);
+}
+
+// ---------------------------------------------------------------------------
+// Low-SMEM shader harness (code/low-smem-shaders, --kernel=...)
+// ---------------------------------------------------------------------------
+// Every kernel there uses the same binding numbers for the same role, but each
+// only declares a subset (V3D allows 8 storage buffers per stage), so each gets
+// its own set layout built from this mask.
+enum LsBinding : uint32_t {
+    LB_A = 0, LB_QS = 1, LB_B = 2, LB_C = 3, LB_SC = 4, LB_MN = 5, LB_LUT = 6, LB_LUT_OFF = 7, LB_8 = 8, LB_9 = 9,
+};
+enum class LsFam { F32, QX, KIQ };
+
+struct LsKernel {
+    const char* name;
+    const char* spv;      // relative to the build dir
+    bool  gemv;           // N=1, local_size_x_id=1 (WG_X); else 16x16 tiles
+    LsFam fam;
+    bool  dbuf;           // *_db_v4: ping-pong SMEM, vec4 aliases, push flags
+    uint32_t bindings;    // mask of LsBinding
+    uint32_t b8, b9;      // what bindings 8/9 alias (LB_A, LB_B, or UINT32_MAX for the Σb buffer)
+};
+
+static constexpr uint32_t kBsum = UINT32_MAX;
+static const LsKernel kLsKernels[] = {
+    {"gemv_f32",    "shaders/lowsmem/mul_mat_vec_low_smem_f32.spv",         true,  LsFam::F32, false, 1u<<LB_A|1u<<LB_B|1u<<LB_C|1u<<LB_9, 0, LB_A},
+    {"gemv_qx",     "shaders/lowsmem/mul_mat_vec_low_smem_qx.spv",          true,  LsFam::QX,  false, 1u<<LB_QS|1u<<LB_B|1u<<LB_C|1u<<LB_SC, 0, 0},
+    {"gemv_kiq",    "shaders/lowsmem/mul_mat_vec_low_smem_k_iq.spv",        true,  LsFam::KIQ, false, 0x1FEu, kBsum, 0},
+    {"gemm_f32_sb", "shaders/lowsmem/mul_mat_mat_low_smem_f32_sb_v1.spv",   false, LsFam::F32, false, 1u<<LB_A|1u<<LB_B|1u<<LB_C, 0, 0},
+    {"gemm_f32_db", "shaders/lowsmem/mul_mat_mat_low_smem_f32_db_v4.spv",   false, LsFam::F32, true,  1u<<LB_A|1u<<LB_B|1u<<LB_C|1u<<LB_8|1u<<LB_9, LB_A, LB_B},
+    {"gemm_qx_sb",  "shaders/lowsmem/mul_mat_mat_low_smem_qx_sb_v1.spv",    false, LsFam::QX,  false, 1u<<LB_QS|1u<<LB_B|1u<<LB_C|1u<<LB_SC, 0, 0},
+    {"gemm_qx_db",  "shaders/lowsmem/mul_mat_mat_low_smem_qx_db_v4.spv",    false, LsFam::QX,  true,  1u<<LB_QS|1u<<LB_B|1u<<LB_C|1u<<LB_SC|1u<<LB_9, 0, LB_B},
+    {"gemm_kiq_sb", "shaders/lowsmem/mul_mat_mat_low_smem_k_iq_sb_v1.spv",  false, LsFam::KIQ, false, 0xFEu, 0, 0},
+    {"gemm_kiq_db", "shaders/lowsmem/mul_mat_mat_low_smem_k_iq_db_v4.spv",  false, LsFam::KIQ, true,  0xFEu|1u<<LB_9, 0, LB_B},
+};
+
+static bool fam_has(LsFam f, QType t) {
+    switch (f) {
+    case LsFam::F32: return t == QType::F32;
+    case LsFam::QX:  return t == QType::Q4_0 || t == QType::Q8_0;
+    case LsFam::KIQ: return t == QType::Q4_K || t == QType::Q6_K;
+    }
+    return false;
+}
+
+// One point of a kernel's spec-constant space
+struct LsCand {
+    // GEMV: WG_X, RPT, K_TILE, VEC_W, SMEM_PAD, USE_BSUM
+    // GEMM: TILE_M, TILE_N, TILE_K, TM, TN, PAD (PAD_A = PAD_B), VEC4 (push flags)
+    uint32_t v[7];
+};
+
+static std::string ls_label(const LsKernel& k, const LsCand& c) {
+    char buf[160];
+    if (k.gemv) snprintf(buf, sizeof(buf), "WG_X=%u RPT=%u K_TILE=%u VEC_W=%u SMEM_PAD=%u%s",
+                         c.v[0], c.v[1], c.v[2], c.v[3], c.v[4], k.fam == LsFam::KIQ ? (c.v[5] ? " USE_BSUM=1" : " USE_BSUM=0") : "");
+    else snprintf(buf, sizeof(buf), "TILE=%ux%ux%u TM=%u TN=%u PAD=%u VEC4=%u",
+                  c.v[0], c.v[1], c.v[2], c.v[3], c.v[4], c.v[5], c.v[6]);
+    return buf;
+}
+
+static uint32_t ls_smem_bytes(const LsKernel& k, const LsCand& c) {
+    if (k.gemv) return 4u * 2u * (c.v[2] + c.v[4]);
+    if (k.dbuf) return 4u * 2u * (c.v[0] * c.v[2] + c.v[2] * c.v[1]);
+    return 4u * (c.v[0] * (c.v[2] + c.v[5]) + c.v[2] * (c.v[1] + c.v[5]));
+}
+
+// Spec-constant sweep. The GEMM kernels have a fixed 16x16 workgroup and each
+// thread owns TM x TN outputs, so TILE_M = 16*TM and TILE_N = 16*TN.
+
+static std::vector<LsCand> ls_grid(const VulkanCtx& C, const LsKernel& k, int argc, char** argv) {
+    const char *s_wg=nullptr, *s_rpt=nullptr, *s_kt=nullptr, *s_vw=nullptr, *s_pad=nullptr, *s_micro=nullptr, *s_tk=nullptr;
+    for (int i=1;i<argc;i++){
+        const char* a = argv[i];
+        if (!strncmp(a,"--wg=",5)) s_wg = a+5;
+        else if (!strncmp(a,"--rpt=",6)) s_rpt = a+6;
+        else if (!strncmp(a,"--ktile=",8)) s_kt = a+8;
+        else if (!strncmp(a,"--vecw=",7)) s_vw = a+7;
+        else if (!strncmp(a,"--pad=",6)) s_pad = a+6;
+        else if (!strncmp(a,"--micro=",8)) s_micro = a+8;
+        else if (!strncmp(a,"--tilek=",8)) s_tk = a+8;
+    }
+    const uint32_t smem_max = C.props.limits.maxComputeSharedMemorySize;
+    std::vector<LsCand> G;
+    if (k.gemv) {
+        auto wgs = parse_u32_list(s_wg, {64, 128, 256});
+        auto rpts = parse_u32_list(s_rpt, {1, 2, 4});
+        auto kts = parse_u32_list(s_kt, {256, 512, 1024});
+        auto vws = parse_u32_list(s_vw, {1, 4});
+        auto pads = parse_u32_list(s_pad, {0, 4});
+        std::vector<uint32_t> bsums = (k.fam == LsFam::KIQ) ? std::vector<uint32_t>{0, 1} : std::vector<uint32_t>{0};
+        for (uint32_t wg : wgs) for (uint32_t rpt : rpts) for (uint32_t kt : kts)
+        for (uint32_t vw : vws) for (uint32_t pad : pads) for (uint32_t bs : bsums) {
+            if (wg > C.props.limits.maxComputeWorkGroupInvocations || wg > C.props.limits.maxComputeWorkGroupSize[0]) continue;
+            LsCand c{{wg, rpt, kt, vw, pad, bs, 0}};
+            if (ls_smem_bytes(k, c) <= smem_max) G.push_back(c);
+        }
+    } else {
+        auto micro = parse_lsz(s_micro ? s_micro : "2x2,2x4,4x2,4x4");
+        auto tks = parse_u32_list(s_tk, {8, 16, 32});
+        auto pads = k.dbuf ? std::vector<uint32_t>{0} : parse_u32_list(s_pad, {0, 2});
+        std::vector<uint32_t> vec4s = k.dbuf ? std::vector<uint32_t>{0, 1} : std::vector<uint32_t>{0};
+        for (auto [tm, tn] : micro) for (uint32_t tk : tks) for (uint32_t pad : pads) for (uint32_t v4 : vec4s) {
+            LsCand c{{16*tm, 16*tn, tk, tm, tn, pad, v4}};
+            if (ls_smem_bytes(k, c) <= smem_max) G.push_back(c);
+        }
+    }
+    return G;
+}
+
+static VkResult create_ls_pipeline(const VulkanCtx& C, VkShaderModule mod, VkPipelineLayout layout, VkPipelineCache cache,
+                                   const LsKernel& k, const LsCand& c, QType qt, VkPipeline* pipe) {
+    uint32_t tid = qtype_shader_id(qt);
+    std::vector<uint32_t> vals;
+    if (k.gemv) vals = { tid, c.v[0], c.v[1], c.v[2], c.v[3], c.v[4], c.v[5] };           // ids 0..6
+    else        vals = { tid, c.v[0], c.v[1], c.v[2], c.v[3], c.v[4], c.v[5], c.v[5] };   // ids 0..7
+    std::vector<VkSpecializationMapEntry> me(vals.size());
+    for (uint32_t i=0;i<me.size();i++){ me[i].constantID=i; me[i].offset=i*sizeof(uint32_t); me[i].size=sizeof(uint32_t); }
+    VkSpecializationInfo si{}; si.mapEntryCount=(uint32_t)me.size(); si.pMapEntries=me.data();
+    si.dataSize=vals.size()*sizeof(uint32_t); si.pData=vals.data();
+
+    VkPipelineShaderStageCreateInfo ss{VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO};
+    ss.stage = VK_SHADER_STAGE_COMPUTE_BIT; ss.module = mod; ss.pName = "main"; ss.pSpecializationInfo = &si;
+    VkComputePipelineCreateInfo pci{VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+    pci.stage = ss; pci.layout = layout;
+    *pipe = VK_NULL_HANDLE;
+    return vkCreateComputePipelines(C.device, cache, 1, &pci, nullptr, pipe);
+}
+
+// --kernel=<name|gemv|gemm|lowsmem>[,...] --qtype=f32,q4_0,q8_0,q4_k,q6_k:
+// sweep the spec constants of the low-SMEM kernels on generated weights.
+static int run_lowsmem(TuneCtx& C, RunCfg& cfg, const std::vector<Shape>& shapes, int argc, char** argv) {
+    std::vector<const LsKernel*> kernels;
+    for (const auto& tok : split_list(cfg.KERNEL)) {
+        size_t before = kernels.size();
+        for (const LsKernel& k : kLsKernels)
+            if (tok == "lowsmem" || tok == k.name || (tok == "gemv" && k.gemv) || (tok == "gemm_ls" && !k.gemv)) kernels.push_back(&k);
+        if (kernels.size() == before) { fprintf(stderr, "Unknown --kernel=%s\n", tok.c_str()); return 1; }
+    }
+    std::vector<QType> qtypes;
+    for (const auto& tok : split_list(cfg.QTYPE)) {
+        QType t; if (!parse_qtype(tok.c_str(), t)) { fprintf(stderr, "Unknown --qtype=%s\n", tok.c_str()); return 1; }
+        qtypes.push_back(t);
+    }
+
+    FILE* csv = nullptr;
+    if (cfg.CSV) {
+        csv = fopen(cfg.CSV, "w");
+        if (csv) fprintf(csv, "kernel,qtype,config,smem_bytes,M,N,K,WARM,REP,status,usec_per_iter,gflops,weight_gbps,"
+                              "usec_min,usec_median,usec_p95,usec_stddev,cv,outliers,mem\n");
+    }
+
+    VkPipelineCache pcache = load_pipeline_cache(C, cfg.PIPELINE_CACHE);
+    VkDescriptorPoolSize dps{}; dps.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; dps.descriptorCount = 10;
+    VkDescriptorPoolCreateInfo dpci{VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+    dpci.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+    dpci.maxSets = 1; dpci.poolSizeCount = 1; dpci.pPoolSizes = &dps;
+    VkDescriptorPool dpool; VK_CHECK(vkCreateDescriptorPool(C.device, &dpci, nullptr, &dpool));
+
+    std::mt19937 rng(cfg.SEED);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    struct Best { std::string what; double usec = INFINITY, gbps = 0.0, gflops = 0.0; };
+    std::vector<Best> summary;
+
+    for (const Shape& sh0 : shapes) {
+    for (const LsKernel* kp : kernels) {
+        const LsKernel& k = *kp;
+        Shape sh = sh0; if (k.gemv) sh.N = 1;
+        sh.batch = 1;  // these kernels have no batch dimension; one product per shape
+        std::vector<uint32_t> spv;
+        if (FILE* f = fopen(k.spv, "rb")) { fclose(f); spv = load_spirv(k.spv); }
+        else { printf("# %s: %s not built, skipping\n", k.name, k.spv); continue; }
+        VkShaderModule mod = make_shader(C.device, spv);
+
+        // Set layout from the binding mask; push range sized to the kernel's block
+        std::vector<VkDescriptorSetLayoutBinding> lb;
+        for (uint32_t i=0;i<10;i++) if (k.bindings & (1u<<i)) {
+            VkDescriptorSetLayoutBinding b{}; b.binding=i; b.descriptorType=VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            b.descriptorCount=1; b.stageFlags=VK_SHADER_STAGE_COMPUTE_BIT; lb.push_back(b);
+        }
+        VkDescriptorSetLayoutCreateInfo dlci{VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
+        dlci.bindingCount = (uint32_t)lb.size(); dlci.pBindings = lb.data();
+        VkDescriptorSetLayout dsl; VK_CHECK(vkCreateDescriptorSetLayout(C.device, &dlci, nullptr, &dsl));
+        VkPushConstantRange pcr{}; pcr.size = 16*sizeof(uint32_t); pcr.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        VkPipelineLayoutCreateInfo plci{VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+        plci.setLayoutCount = 1; plci.pSetLayouts = &dsl; plci.pushConstantRangeCount = 1; plci.pPushConstantRanges = &pcr;
+        VkPipelineLayout layout; VK_CHECK(vkCreatePipelineLayout(C.device, &plci, nullptr, &layout));
+
+        auto grid = ls_grid(C, k, argc, argv);
+        for (QType qt : qtypes) {
+            if (!fam_has(k.fam, qt)) continue;
+            const uint32_t M = sh.M, N = sh.N, K = sh.K;
+            printf("# %s %s M=%u N=%u K=%u: %zu configs\n", k.name, qtype_name(qt), M, N, K, grid.size());
+            fflush(stdout);
+
+            // Weights, activations and the CPU reference on the dequantized weights
+            std::vector<float> A((size_t)M * K), B((size_t)K * N);
+            for (float& x : A) x = dist(rng);
+            for (float& x : B) x = dist(rng);
+            QuantBlob q = quantize(qt, A.data(), M, K);
+            std::vector<float> ref;
+            double atol = cfg.VERIFY_ATOL > 0.0 ? cfg.VERIFY_ATOL : 1e-6 * double(K);
+            if (cfg.VERIFY) {
+                ref.resize((size_t)M * N);
+                cpu_sgemm(M, N, K, q.deq.data(), K, B.data(), N, ref.data(), N, cfg.CPU_THREADS);
+            }
+            std::vector<float> bs = block_sums(B.data(), K);  // GEMV only: B is the vector
+
+            // All bindings in one arena; unused ones (IQ codebooks, A for quantized
+            // formats) still need a valid buffer and get a zero-filled stub
+            auto bytes_of = [](const auto& v){ return v.size() * sizeof(v[0]); };
+            const std::pair<const void*, size_t> src[9] = {
+                {A.data(), qt == QType::F32 ? bytes_of(A) : 0}, {q.qs.data(), bytes_of(q.qs)}, {B.data(), bytes_of(B)},
+                {nullptr, (size_t)M * N * sizeof(float)}, {q.sc.data(), bytes_of(q.sc)}, {q.mn.data(), bytes_of(q.mn)},
+                {nullptr, 0}, {nullptr, 0}, {bs.data(), bytes_of(bs)},
+            };
+            GpuBuf bufs[9];
+            std::vector<GpuBuf*> bp;
+            for (uint32_t i=0;i<9;i++) { bufs[i].size = std::max<size_t>(src[i].second, 16); bp.push_back(&bufs[i]); }
+            MemArena arena = create_arena(C, cfg.MEM, bp);
+            for (uint32_t i=0;i<9;i++) {
+                if (src[i].first && src[i].second) gpu_write(C, arena, bufs[i], src[i].first, src[i].second);
+                else gpu_fill(C, arena, bufs[i], 0u, bufs[i].size);
+            }
+            const std::string mem = std::string(mem_place_name(cfg.MEM)) + "@" + mem_type_desc(arena);
+            auto buf_for = [&](uint32_t bind) -> const GpuBuf& {
+                if (bind == LB_8) return k.b8 == kBsum ? bufs[LB_8] : bufs[k.b8];
+                if (bind == LB_9) return bufs[k.b9];
+                return bufs[bind];
+            };
+
+            VkDescriptorSetAllocateInfo dsai{VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+            dsai.descriptorPool = dpool; dsai.descriptorSetCount = 1; dsai.pSetLayouts = &dsl;
+            VkDescriptorSet dset; VK_CHECK(vkAllocateDescriptorSets(C.device, &dsai, &dset));
+            std::vector<VkDescriptorBufferInfo> bi(lb.size());
+            std::vector<VkWriteDescriptorSet> w(lb.size());
+            for (size_t i=0;i<lb.size();i++) {
+                const GpuBuf& b = buf_for(lb[i].binding);
+                bi[i] = {b.buf, 0, b.size};
+                w[i] = {VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+                w[i].dstSet = dset; w[i].dstBinding = lb[i].binding; w[i].descriptorCount = 1;
+                w[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; w[i].pBufferInfo = &bi[i];
+            }
+            vkUpdateDescriptorSets(C.device, (uint32_t)w.size(), w.data(), 0, nullptr);
+
+            std::vector<float> hC(cfg.VERIFY ? (size_t)M * N : 0);
+            const uint32_t tid = qtype_shader_id(qt), bpr = q.blocks_per_row, bsq = q.block_sz_q;
+            Best best; best.what = std::string(k.name) + " " + qtype_name(qt) + " " + shape_label(sh);
+
+            for (const LsCand& c : grid) {
+                std::string label = ls_label(k, c);
+                printf("  [%s] %s ...\n", k.name, label.c_str());
+                VkPipeline pipe;
+                VkResult pr = create_ls_pipeline(C, mod, layout, pcache, k, c, qt, &pipe);
+                Meas m;
+                if (pr != VK_SUCCESS) { m.status = "COMPILE_FAIL"; }
+                else {
+                    Launch L; L.pipe = pipe; L.layout = layout; L.dset = dset;
+                    L.flops = 2.0 * double(M) * double(N) * double(K);
+                    L.bytes = double(q.weight_bytes());
+                    // vec4 paths need 16-byte aligned rows (push flags: bit0 B, bit1 A)
+                    uint32_t flags = c.v[6] ? ((N % 4 == 0 ? 1u : 0u) | (K % 4 == 0 && c.v[2] % 4 == 0 ? 2u : 0u)) : 0u;
+                    if (k.gemv) {
+                        L.gx = ceil_div(M, c.v[0] * c.v[1]);
+                        if (k.fam == LsFam::F32) L.push = { M, K, K, 0, 0, 0 };
+                        else if (k.fam == LsFam::QX) L.push = { M, K, 0, 0, 0, 0, bpr };
+                        else L.push = { M, K, 0, 0, 0, 0, 0, bsq, bpr };
+                    } else {
+                        L.gx = ceil_div(N, c.v[1]);
+                        L.gy = ceil_div(M, c.v[0]);
+                        if (k.fam == LsFam::F32) L.push = { M, N, K, K, N, N, 0, 0, 0 };
+                        else if (k.fam == LsFam::QX) L.push = { M, N, K, N, N, 0, 0, 0, 0, bpr };
+                        else L.push = { M, N, K, N, N, 0, 0, 0, 0, 0, bsq, bpr };
+                        if (k.dbuf) L.push.push_back(k.fam == LsFam::F32 ? flags : (flags & 1u));
+                        if (k.dbuf && k.fam == LsFam::KIQ) L.push.push_back(tid);
+                    }
+                    if (cfg.VERIFY) gpu_fill(C, arena, bufs[LB_C], 0x7fc00000u, (size_t)M * N * sizeof(float));  // NaN
+                    m = measure(C, L, cfg, cfg.WARM, cfg.REP);
+                    if (cfg.VERIFY && (m.status == "OK" || m.status == "PARTIAL")) {
+                        gpu_read(C, arena, bufs[LB_C], hC.data(), hC.size() * sizeof(float));
+                        VerifyRes v = verify_c(hC.data(), ref.data(), hC.size(), cfg.VERIFY_RTOL, atol, cfg.VERIFY_ULP);
+                        m.verified = true;
+                        if (v.bad) {
+                            printf("  -> [WRONG_RESULT] %zu/%zu mismatches  max_abs=%.3g max_rel=%.3g\n",
+                                v.bad, (size_t)M * N, v.max_abs, v.max_rel);
+                            m.status = "WRONG_RESULT";
+                        }
+                    }
+                    vkDestroyPipeline(C.device, pipe, nullptr);
+                }
+                if (m.status == "OK" || m.status == "PARTIAL")
+                    printf("  -> [%s] usec=%.3f  median=%.3f  GFLOP/s=%.3f  weights GB/s=%.3f  cv=%.3f\n",
+                        m.status.c_str(), m.usec, m.st.median, m.gflops, m.gbps, m.st.cv);
+                else if (m.status != "WRONG_RESULT")
+                    printf("  -> [%s]\n", m.status.c_str());
+                fflush(stdout);
+                if (csv) fprintf(csv, "%s,%s,%s,%u,%u,%u,%u,%u,%u,%s,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%u,%s\n",
+                    k.name, qtype_name(qt), label.c_str(), ls_smem_bytes(k, c), M, N, K, cfg.WARM, cfg.REP, m.status.c_str(),
+                    m.usec, m.gflops, m.gbps, m.st.min, m.st.median, m.st.p95, m.st.stddev, m.st.cv, m.st.outliers, mem.c_str());
+                if (m.status == "OK" && m.st.median < best.usec) {
+                    best.usec = m.st.median; best.gflops = 2.0 * double(M) * double(N) * double(K) / (m.st.median * 1e3);
+                    best.gbps = double(q.weight_bytes()) / (m.st.median * 1e3);
+                    best.what = std::string(k.name) + " " + qtype_name(qt) + " " + shape_label(sh) + "  " + label;
+                }
+            }
+            if (std::isfinite(best.usec)) summary.push_back(best);
+
+            VK_CHECK(vkFreeDescriptorSets(C.device, dpool, 1, &dset));
+            destroy_arena(C, arena, bp);
+        }
+        vkDestroyPipelineLayout(C.device, layout, nullptr);
+        vkDestroyDescriptorSetLayout(C.device, dsl, nullptr);
+        vkDestroyShaderModule(C.device, mod, nullptr);
+    }
+    }
+
+    printf("\n# best per kernel/format/shape (median)\n");
+    for (const Best& b : summary)
+        printf("#   %s  median=%.3f usec  GFLOP/s=%.3f  weights GB/s=%.3f\n", b.what.c_str(), b.usec, b.gflops, b.gbps);
+
+    if (csv) fclose(csv);
+    save_pipeline_cache(C, pcache, cfg.PIPELINE_CACHE);
+    vkDestroyPipelineCache(C.device, pcache, nullptr);
+    vkDestroyDescriptorPool(C.device, dpool, nullptr);
+    return 0;
+}
+
+int main(int argc, char** argv){
+    TuneCtx C; init_vulkan(C);
+    VkQueryPoolCreateInfo qpci{VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+    qpci.queryType = VK_QUERY_TYPE_TIMESTAMP; qpci.queryCount = 2 * kMaxChunk;
+    VK_CHECK(vkCreateQueryPool(C.device, &qpci, nullptr, &C.qpool));
+    auto cfg = env_runcfg(argc, argv);
+    const bool halving = cfg.SEARCH == "halving", model = cfg.SEARCH == "model";
+    if (!halving && !model && cfg.SEARCH != "exhaustive") { fprintf(stderr, "Unknown --search=%s\n", cfg.SEARCH.c_str()); return 1; }
+
+    // Shapes to sweep; buffers are sized for the largest and reused by all
+    auto shapes = parse_shapes(cfg);
+    if (cfg.KERNEL != "gemm") {
+        int rc = run_lowsmem(C, cfg, shapes, argc, argv);
+        vkDestroyQueryPool(C.device, C.qpool, nullptr);
+        destroy_vulkan(C);
+        return rc;
+    }
+    // Build candidate grid
+    auto grid = build_grid(C.props, C.subprops.subgroupSize, cfg.EPILOGUE, cfg.FUSE, argc, argv);
+    uint32_t max_splitk = 1;
+    bool any_unfused = false, any_packb = false;
+    for (const Cand& g : grid) { max_splitk = std::max(max_splitk, g.splitk); any_unfused |= g.epi && !g.fused; any_packb |= g.packb != 0; }
+
+    // Out-of-core shapes are tuned on their panel sub-problem, then run whole
+    // with streamed panels after their search (run_out_of_core)
+    const uint64_t max_range = C.props.limits.maxStorageBufferRange;
+    const uint64_t ooc_limit = cfg.PANEL_MIB ? std::min<uint64_t>(uint64_t(cfg.PANEL_MIB) << 20, max_range) : max_range;
+    const uint64_t ooc_panel = cfg.PANEL_MIB ? ooc_limit : std::min<uint64_t>(256ull << 20, max_range);
+    const std::vector<Shape> full_shapes = shapes;
+    std::vector<OocPlan> ooc(shapes.size());
+    for (size_t s=0; s<shapes.size(); s++) {
+        ooc[s] = ooc_plan(shapes[s], ooc_limit, ooc_panel);
+        if (!ooc[s].on) continue;
+        fprintf(stderr, "# out-of-core %s: tuned and run as %ux%ux%u panels\n", shape_label(shapes[s]).c_str(), ooc[s].Mt, ooc[s].Nt, ooc[s].Kt);
+        shapes[s].M = ooc[s].Mt; shapes[s].N = ooc[s].Nt; shapes[s].K = ooc[s].Kt; shapes[s].batch = 1;
+    }
+
+    size_t sizeA = 0, sizeB = 0, sizeC = 0, sizeBias = 4;
+    for (const Shape& sh : shapes) {
+        sizeBias = std::max(sizeBias, (size_t)sh.N * sizeof(float));
+        sizeA = std::max(sizeA, (size_t)sh.M * sh.K * sh.batch * sizeof(float));
+        sizeB = std::max(sizeB, (size_t)sh.K * sh.N * sh.batch * sizeof(float));
+        sizeC = std::max(sizeC, (size_t)sh.M * sh.N * sh.batch * sizeof(float));
+    }
+    // Split-K partials: one M x N layer per slice
+    const size_t sizeW = max_splitk > 1 ? sizeC * max_splitk : 0;
+    // Packed B: the largest padded layout of any packed candidate on any shape
+    size_t sizeP = 0;
+    for (const Shape& sh : shapes)
+        for (const Cand& g : grid)
+            if (g.packb) sizeP = std::max(sizeP, packed_b_floats(sh.K, sh.N, g.TK, g.TN) * sh.batch * sizeof(float));
+    if (std::max({sizeA, sizeB, sizeC, sizeW, sizeP}) > C.props.limits.maxStorageBufferRange) {
+        fprintf(stderr, "Largest shape needs %zu MiB buffers > maxStorageBufferRange%s\n", std::max({sizeA, sizeB, sizeC, sizeW, sizeP}) >> 20,
+                sizeW > sizeC ? " (lower --splitk)" : "");
+        return 1;
+    }
+    // Unfused epilogue: GEMM result before the elementwise pass
+    const size_t sizeT = any_unfused ? sizeC : 0;
+    C.bufA.size = sizeA; C.bufB.size = sizeB; C.bufC.size = sizeC; C.bufW.size = sizeW;
+    C.bufBias.size = sizeBias; C.bufT.size = sizeT; C.bufP.size = sizeP;
+    std::vector<GpuBuf*> abc{&C.bufA, &C.bufB, &C.bufC, &C.bufBias};
+    if (sizeW) abc.push_back(&C.bufW);
+    if (sizeT) abc.push_back(&C.bufT);
+    if (sizeP) abc.push_back(&C.bufP);
+    C.arena = create_arena(C, cfg.MEM, abc);
+    const std::string mem = std::string(mem_place_name(cfg.MEM)) + "@" + mem_type_desc(C.arena);
+    cfg.MEM_USED = mem;
+    fprintf(stderr, "# memory: %s, one %.1f MiB block%s\n", mem.c_str(), double(C.arena.size) / (1 << 20),
+            cfg.MEM == MemPlace::Device ? ", staging upload/readback" : "");
+    // Hybrid: the CPU works in the same buffers while the GPU runs, so they must
+    // be mapped and coherent (no flush could separate rows sharing a cache line)
+    bool any_cpu = false;
+    for (const Cand& g : grid) any_cpu |= g.cpu > 0;
+    cfg.WALL = any_cpu;
+    if (any_cpu && (!C.arena.map || !(C.arena.flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))) {
+        fprintf(stderr, "--cpu-split needs mapped host-coherent buffers, %s is not (use --mem=coherent)\n", mem.c_str());
+        return 1;
+    }
+    if (any_cpu) fprintf(stderr, "# hybrid: CPU rows on %u threads (%s)\n",
+                         cfg.CPU_THREADS ? cfg.CPU_THREADS : std::max(1u, std::thread::hardware_concurrency()), cpu_sgemm_isa());
+
+    // --streams: stream counts of the throughput mode, buffers for the most of them
+    std::vector<uint32_t> stream_counts;
+    for (uint32_t n : parse_u32_list(cfg.STREAMS.c_str(), std::vector<uint32_t>{})) if (n) stream_counts.push_back(n);
+    if (!stream_counts.empty() && !C.timeline) {
+        fprintf(stderr, "--streams needs timeline semaphores (Vulkan 1.2), which %s does not have\n", C.props.deviceName);
+        return 1;
+    }
+    Streams strm;
+    if (!stream_counts.empty()) {
+        const uint32_t most = *std::max_element(stream_counts.begin(), stream_counts.end());
+        strm = create_streams(C, cfg, most, sizeA, sizeB, sizeC);
+        fprintf(stderr, "# streams: %s on %zu queue%s, up to %u x %.1f MiB of A/B/C\n", cfg.STREAMS.c_str(), C.queues.size(),
+                C.queues.size() == 1 ? "" : "s", most, double(sizeA + sizeB + sizeC) / (1 << 20));
+    }
+
+    // Fill A,B with 1.0f (bias 0), or seeded uniform [-1,1) for --verify. An
+    // alpha/beta epilogue also gets a random initial C (hostC0) to check against.
+    std::vector<float> hostA, hostB, hostC, hostC0, hostBias, ref;
+    double cpu_gflops = 0.0;
+    if (!cfg.VERIFY) {
+        gpu_fill(C, C.arena, C.bufA, 0x3f800000u, sizeA);  // 1.0f
+        gpu_fill(C, C.arena, C.bufB, 0x3f800000u, sizeB);
+        gpu_fill(C, C.arena, C.bufBias, 0u, sizeBias);
+    } else {
+        std::mt19937 rng(cfg.SEED);
+        std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+        hostA.resize(sizeA/4); for (float& x : hostA) x = dist(rng);
+        hostB.resize(sizeB/4); for (float& x : hostB) x = dist(rng);
+        hostBias.resize(sizeBias/4); for (float& x : hostBias) x = dist(rng);
+        gpu_write(C, C.arena, C.bufA, hostA.data(), sizeA);
+        gpu_write(C, C.arena, C.bufB, hostB.data(), sizeB);
+        gpu_write(C, C.arena, C.bufBias, hostBias.data(), sizeBias);
+        hostC.resize(sizeC/4);
+        ref.resize(sizeC/4);
+        if (cfg.EPILOGUE & EPI_SCALE) { hostC0.resize(sizeC/4); for (float& x : hostC0) x = dist(rng); }
+    }
+    // --packb packs from a host copy of B
+    if (any_packb && hostB.empty()) hostB.assign(sizeB/4, 1.0f);
+    // CPU reference for the current shape (A is MxK with lda=K, B is KxN with ldb=N,
+    // batch entries packed back to back)
+    double atol = cfg.VERIFY_ATOL;
+    auto make_ref = [&](){
+        if (!cfg.VERIFY) return;
+        atol = cfg.VERIFY_ATOL > 0.0 ? cfg.VERIFY_ATOL : 1e-6 * double(cfg.K);
+        auto t0 = std::chrono::steady_clock::now();
+        for (uint32_t b=0; b<cfg.BATCH; b++)
+            cpu_sgemm(cfg.M, cfg.N, cfg.K, hostA.data() + (size_t)b * cfg.M * cfg.K, cfg.K,
+                      hostB.data() + (size_t)b * cfg.K * cfg.N, cfg.N, ref.data() + (size_t)b * cfg.M * cfg.N, cfg.N, cfg.CPU_THREADS);
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        if (cfg.EPILOGUE) {
+            size_t n = (size_t)cfg.M * cfg.N * cfg.BATCH;
+            for (size_t i=0;i<n;i++)
+                ref[i] = epilogue_ref(cfg.EPILOGUE, ref[i], hostC0.empty() ? 0.0f : hostC0[i], hostBias[i % cfg.N], cfg.ALPHA, cfg.BETA);
+        }
+        cpu_gflops = 2.0 * double(cfg.M) * double(cfg.N) * double(cfg.K) * double(cfg.BATCH) / (secs * 1e9);
+        fprintf(stderr, "# verify: seed=%u rtol=%g atol=%g ulp=%u  CPU reference (%s, %u threads): %.1f ms, %.3f GFLOP/s\n",
+            cfg.SEED, cfg.VERIFY_RTOL, atol, cfg.VERIFY_ULP, cpu_sgemm_isa(),
+            cfg.CPU_THREADS ? cfg.CPU_THREADS : std::max(1u, std::thread::hardware_concurrency()), secs * 1e3, cpu_gflops);
+    };
+
+    // Descriptor sets, see GemmSets
+    VkDescriptorBufferInfo biA{C.bufA.buf,0,sizeA}, biB{C.bufB.buf,0,sizeB}, biC{C.bufC.buf,0,sizeC}, biW{C.bufW.buf,0,sizeW};
+    VkDescriptorBufferInfo biBias{C.bufBias.buf,0,sizeBias}, biT{C.bufT.buf,0,sizeT}, biP{C.bufP.buf,0,sizeP};
+    auto make_set = [&](const VkDescriptorBufferInfo* b0, const VkDescriptorBufferInfo* b2, const VkDescriptorBufferInfo* b1 = nullptr){
+        VkDescriptorSetAllocateInfo dsai{VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+        dsai.descriptorPool = C.dpool; dsai.descriptorSetCount=1; dsai.pSetLayouts=&C.dsl;
+        VkDescriptorSet dset; VK_CHECK(vkAllocateDescriptorSets(C.device, &dsai, &dset));
+        VkWriteDescriptorSet w[4]{};
+        for (int i=0;i<4;i++){ w[i].sType=VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET; w[i].dstSet=dset; w[i].dstBinding=i; w[i].descriptorCount=1; w[i].descriptorType=VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; }
+        w[0].pBufferInfo=b0; w[1].pBufferInfo=b1 ? b1 : &biB; w[2].pBufferInfo=b2; w[3].pBufferInfo=&biBias;
+        vkUpdateDescriptorSets(C.device, 4, w, 0, nullptr);
+        return dset;
+    };
+    GemmSets sets;
+    sets.direct = make_set(&biA, &biC);
+    if (sizeW) {
+        sets.split  = make_set(&biA, &biW);
+        sets.reduce = make_set(&biW, &biC);
+        fprintf(stderr, "# split-K: up to %u slices, %.1f MiB partials\n", max_splitk, double(sizeW) / (1 << 20));
+    }
+    if (sizeT) {
+        sets.to_t = make_set(&biA, &biT);
+        sets.epi  = make_set(&biT, &biC);
+        if (sizeW) sets.reduce_t = make_set(&biW, &biT);
+    }
+    if (sizeP) {
+        sets.direct_p = make_set(&biA, &biC, &biP);
+        if (sizeW) sets.split_p = make_set(&biA, &biW, &biP);
+        if (sizeT) sets.to_t_p  = make_set(&biA, &biT, &biP);
+        fprintf(stderr, "# packed B: %.1f MiB for the largest panel layout, amortized over %u calls\n", double(sizeP) / (1 << 20), cfg.PACK_CALLS);
+    }
+    // reduce_epilogue.comp, plain and with the run's epilogue
+    VkShaderModule reduce_mod = VK_NULL_HANDLE;
+    if (sizeW || cfg.EPILOGUE) {
+        reduce_mod = make_shader(C.device, load_spirv("shaders/reduce_epilogue.spv"));
+        VK_CHECK(create_reduce_pipeline(C, reduce_mod, VK_NULL_HANDLE, 0, &sets.reduce_pipe));
+        if (cfg.EPILOGUE) VK_CHECK(create_reduce_pipeline(C, reduce_mod, VK_NULL_HANDLE, cfg.EPILOGUE, &sets.epi_pipe));
+    }
+
+    // Memory roof for the roofline columns
+    const double bw_gbps = measure_bandwidth(C, cfg, cfg.BANDWIDTH_MIB);
+    if (bw_gbps > 0.0 && cfg.PEAK_GFLOPS > 0.0)
+        fprintf(stderr, "# roofline: %.2f GB/s, peak %.1f GFLOP/s, ridge at %.1f FLOP/B\n", bw_gbps, cfg.PEAK_GFLOPS, cfg.PEAK_GFLOPS / bw_gbps);
+    else if (bw_gbps > 0.0)
+        fprintf(stderr, "# roofline: %.2f GB/s, memory roof only (set --peak-gflops=)\n", bw_gbps);
+
+    // Thermal state and power around every measurement
+    const SysProbe probe = sys_probe();
+    PowerMeter power(cfg.HWMON);
+    fprintf(stderr, "# thermal: %s; temp-max %.0f C, cooldown up to %us, %u re-measure%s when throttled; power %s; order %s\n",
+        probe.describe().c_str(), cfg.TEMP_MAX, cfg.COOLDOWN_S, cfg.THROTTLE_RETRIES, cfg.THROTTLE_RETRIES == 1 ? "" : "s",
+        power.available() ? power.describe().c_str() : "not measured", cfg.ORDER.c_str());
+
+    // Load the shader of each family in the grid (in build dir)
+    const char* spv_paths[kFamilies] = { "shaders/gemm.spv", "shaders/gemm_v2.spv" };
+    VkShaderModule mods[kFamilies] = {};
+    std::string key_prefix[kFamilies];
+    for (uint32_t f=0; f<kFamilies; f++) {
+        if (std::none_of(grid.begin(), grid.end(), [&](const Cand& g){ return g.fam == f; })) continue;
+        auto spv = load_spirv(spv_paths[f]);
+        mods[f] = make_shader(C.device, spv);
+        key_prefix[f] = db_prefix(C, spv);
+    }
+
+    // Persistent results store
+    TuneDb db; db_open(db, cfg.DB);
+
+    // keys[s][gi]: DB key of candidate gi on shape s
+    std::vector<std::vector<std::string>> all_keys(shapes.size(), std::vector<std::string>(grid.size()));
+    std::vector<std::string>* keys = &all_keys[0];
+
+    size_t si = 0; // current shape
+
+    // CSV header
+    FILE* csv = nullptr;
+    if (cfg.CSV) {
+        csv = fopen(cfg.CSV, "w");
+        if (csv) fprintf(csv, "TM,TN,TK,lszx,lszy,smem,M,N,K,WARM,REP,status,usec_per_iter,gflops,"
+                              "usec_min,usec_median,usec_p95,usec_stddev,cv,outliers,shape,mem,family,vec,dbuf,pad,splitk,batch,epilogue,cpu_split,cpu_usec,gpu_usec,"
+                              "model_bytes,ai,model_gbps,roof_gflops,roof_eff,pipe_stats,temp_c,cpu_mhz,gpu_mhz,throttled,watts,j_per_gflop,packb,pack_ms\n");
+    }
+    // pstats[gi]: compiler statistics, read once when the pipeline is first used
+    std::vector<std::string> pstats(grid.size());
+    // --packb: ms to pack and upload the current shape's B per (TK, TN) layout,
+    // the one-off cost of a constant weight matrix
+    std::map<std::pair<uint32_t,uint32_t>, double> pack_ms;
+    // Energy per GFLOP at the median time; NaN without a power reading
+    auto j_per_gflop = [&](const Meas& m){
+        const double gflop = 2.0 * double(cfg.M) * double(cfg.N) * double(cfg.K) * double(cfg.BATCH) * 1e-9;
+        return std::isfinite(m.watts) && m.st.median > 0.0 ? m.watts * m.st.median * 1e-6 / gflop : NAN;
+    };
+    // Unknown sysfs readings are empty fields
+    auto opt_col = [](double v, const char* fmt){
+        char buf[32] = "";
+        if (std::isfinite(v) && v != 0.0) snprintf(buf, sizeof(buf), fmt, v);
+        return std::string(buf);
+    };
+    auto csv_row = [&](size_t gi, const Meas& m){
+        const Cand& g = grid[gi];
+        Roof rf = roofline(g, cfg, m.gflops, bw_gbps, cfg.PEAK_GFLOPS);
+        double model_gbps = m.usec > 0.0 ? rf.bytes / (m.usec * 1e3) : 0.0;
+        if (csv) fprintf(csv, "%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%s,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%u,%s,%s,v%u,%u,%u,%u,%u,%u,%s,%u,%.6f,%.6f,"
+                              "%.0f,%.3f,%.3f,%.3f,%.4f,%s,%s,%s,%s,%u,%s,%s,%u,%s\n",
+            g.TM,g.TN,g.TK,g.lszx,g.lszy,g.smem,cfg.M,cfg.N,cfg.K,cfg.WARM,cfg.REP, m.status.c_str(), m.usec, m.gflops,
+            m.st.min, m.st.median, m.st.p95, m.st.stddev, m.st.cv, m.st.outliers, shapes[si].name.c_str(), mem.c_str(),
+            g.fam + 1, g.vec, g.dbuf, g.pad, g.splitk, cfg.BATCH,
+            epilogue_col(g).c_str(), g.cpu, m.cpu_usec, m.gpu_usec,
+            rf.bytes, rf.ai, model_gbps, rf.gflops, rf.eff, pstats[gi].c_str(),
+            opt_col(m.temp_c, "%.1f").c_str(), opt_col(m.cpu_mhz, "%.0f").c_str(), opt_col(m.gpu_mhz, "%.0f").c_str(), m.throttled ? 1u : 0u,
+            opt_col(m.watts, "%.3f").c_str(), opt_col(j_per_gflop(m), "%.6f").c_str(),
+            g.packb, opt_col(g.packb && pack_ms.count({g.TK, g.TN}) ? pack_ms[{g.TK, g.TN}] : 0.0, "%.3f").c_str());
+    };
+    // Measured outcome: goes to the CSV, the DB and the per-shape ranking
+    std::vector<std::pair<Meas,size_t>> ranked;
+    // est_of: median of the last halving probe of a pruned candidate, or the
+    // model's prediction for one never measured, for the warptile thirds
+    ShapeTimes median_of(shapes.size(), std::vector<double>(grid.size(), INFINITY));
+    ShapeTimes est_of(shapes.size(), std::vector<double>(grid.size(), INFINITY));
+    auto record = [&](size_t gi, const Meas& m){
+        csv_row(gi, m);
+        // Still throttled after the retries: good enough to rank this run,
+        // not to be resumed from; the next run measures it again
+        if (!m.throttled) {
+            DbRec r; r.m = m; r.when = (uint64_t)time(nullptr);
+            db_put(db, (*keys)[gi], r);
+        }
+        if (m.status == "OK") ranked.emplace_back(m, gi);
+        if (m.status == "PRUNED" && m.st.median > 0.0) est_of[si][gi] = m.st.median;
+    };
+    auto fail = [](const char* status){ Meas m; m.status = status; return m; };
+
+    // --verify: poison C with NaN before a run so unwritten tiles are caught,
+    // then compare against the CPU reference; mismatches become WRONG_RESULT
+    // With alpha/beta C is read back in, so timed runs accumulate into it: C is
+    // reset to hostC0 and the candidate dispatched once more for the check.
+    auto poison_c = [&](){ if (cfg.VERIFY && !(cfg.EPILOGUE & EPI_SCALE)) gpu_fill(C, C.arena, C.bufC, 0x7fc00000u, (size_t)cfg.M * cfg.N * cfg.BATCH * sizeof(float)); };
+    auto check = [&](Meas& m, const Launch& L){
+        if (!cfg.VERIFY || (m.status != "OK" && m.status != "PARTIAL")) return;
+        size_t n = (size_t)cfg.M * cfg.N * cfg.BATCH;
+        if (cfg.EPILOGUE & EPI_SCALE) {
+            gpu_write(C, C.arena, C.bufC, hostC0.data(), n * sizeof(float));
+            run_candidate(C, L, cfg, 0, 1);
+        }
+        gpu_read(C, C.arena, C.bufC, hostC.data(), n * sizeof(float));
+        VerifyRes v = verify_c(hostC.data(), ref.data(), n, cfg.VERIFY_RTOL, atol, cfg.VERIFY_ULP);
+        m.verified = true;
+        if (v.bad) {
+            printf("  -> [WRONG_RESULT] %zu/%zu mismatches  max_abs=%.3g max_rel=%.3g max_ulp=%u\n",
+                v.bad, n, v.max_abs, v.max_rel, v.max_ulp);
+            m.status = "WRONG_RESULT";
+        } else {
+            printf("  -> verified  max_abs=%.3g max_rel=%.3g max_ulp=%u\n", v.max_abs, v.max_rel, v.max_ulp);
+        }
+    };
+    // --packb: bufP holds B packed for one (TK, TN) of the current shape; a
+    // candidate with another layout repacks it from hostB
+    std::vector<float> packed;
+    size_t packed_si = SIZE_MAX;
+    uint32_t packed_tk = 0, packed_tn = 0;
+    auto ensure_packed = [&](const Cand& g){
+        if (packed_si == si && packed_tk == g.TK && packed_tn == g.TN) return;
+        auto t0 = std::chrono::steady_clock::now();
+        const size_t sP = packed_b_floats(cfg.K, cfg.N, g.TK, g.TN);
+        packed.resize(sP * cfg.BATCH);
+        for (uint32_t b=0; b<cfg.BATCH; b++)
+            pack_b(hostB.data() + (size_t)b * cfg.K * cfg.N, cfg.K, cfg.N, cfg.N, g.TK, g.TN, packed.data() + b * sP);
+        gpu_write(C, C.arena, C.bufP, packed.data(), packed.size() * sizeof(float));
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        if (!pack_ms.count({g.TK, g.TN}))
+            printf("  # packed B into %ux%u blocks (%.1f MiB, %.1f%% padding) in %.2f ms\n", g.TK, g.TN,
+                double(packed.size()) * sizeof(float) / (1 << 20), 100.0 * (double(sP) / (double(cfg.K) * cfg.N) - 1.0), ms);
+        pack_ms[{g.TK, g.TN}] = ms;
+        packed_si = si; packed_tk = g.TK; packed_tn = g.TN;
+    };
+
+    // Candidates outside the SMEM budget or with a valid DB record are not run
+    uint32_t budget = (uint32_t)(C.props.limits.maxComputeSharedMemorySize * std::min(std::max(cfg.SMEM_FRAC,0.5),1.0));
+    // todo[s][gi] for each shape; a pipeline is compiled if any shape needs it
+    std::vector<std::vector<uint8_t>> all_todo(shapes.size(), std::vector<uint8_t>(grid.size(), 0));
+    std::vector<uint8_t> need_pipe(grid.size(), 0);
+    for (size_t s=0;s<shapes.size();s++) {
+        RunCfg sc = cfg; sc.M = shapes[s].M; sc.N = shapes[s].N; sc.K = shapes[s].K; sc.BATCH = shapes[s].batch;
+        for (size_t i=0;i<grid.size();i++) {
+            all_keys[s][i] = db_key(key_prefix[grid[i].fam], grid[i], sc);
+            if (grid[i].smem && smem_bytes(grid[i]) > budget) continue;
+            auto it = db.recs.find(all_keys[s][i]);
+            if (cfg.RESUME && it != db.recs.end() && db_valid(it->second, halving, cfg.VERIFY)) continue;
+            all_todo[s][i] = 1;
+            need_pipe[i] = 1;
+        }
+    }
+
+    // Pipelines: shared on-disk cache, either all built up front in parallel or
+    // built by a background thread just ahead of the measurement loop
+    const auto wall_t0 = std::chrono::steady_clock::now();
+    VkPipelineCache pcache = load_pipeline_cache(C, cfg.PIPELINE_CACHE);
+    std::vector<VkPipeline> pipes(grid.size(), VK_NULL_HANDLE);
+    std::vector<VkResult> pipe_res(grid.size(), VK_NOT_READY);
+    double compile_s = 0.0, exec_s = 0.0;
+    // Candidate order per shape. Shuffled, a slow drift (the SoC heating up over
+    // a long sweep) spreads over the whole grid instead of penalizing its tail;
+    // halving rounds then interleave the survivors in the same order.
+    std::vector<std::vector<size_t>> visit(shapes.size(), std::vector<size_t>(grid.size()));
+    std::mt19937 order_rng(cfg.SEED);
+    for (auto& v : visit) {
+        for (size_t i=0;i<v.size();i++) v[i] = i;
+        if (cfg.ORDER == "shuffle") std::shuffle(v.begin(), v.end(), order_rng);
+        if (any_packb) group_packed(grid, v);
+    }
+    PipeFeeder feeder;
+    if (model) {
+        // built on demand: most of the space is never measured
+    } else if (cfg.PRECOMPILE) {
+        compile_s = precompile(C, mods, pcache, grid, need_pipe, cfg.COMPILE_THREADS, pipes, pipe_res);
+        save_pipeline_cache(C, pcache, cfg.PIPELINE_CACHE);
+    } else {
+        // Same order as the loop below: shape by shape, visit order, each pipeline once
+        std::vector<uint8_t> queued(grid.size(), 0);
+        for (size_t s=0;s<shapes.size();s++)
+            for (size_t i : visit[s])
+                if (all_todo[s][i] && !queued[i]) { queued[i] = 1; feeder.order.push_back(i); }
+        feeder.C = &C; feeder.mods = mods; feeder.cache = pcache; feeder.grid = &grid;
+        feeder.pipes = &pipes; feeder.res = &pipe_res; feeder.depth = std::max(1u, cfg.COMPILE_AHEAD);
+        feeder.start();
+    }
+
+    // Pipeline for candidate gi, kept until the candidate is settled (halving
+    // measures it several times). A multi-shape sweep keeps every pipeline
+    // until the last shape.
+    const bool keep_pipes = shapes.size() > 1;
+    auto get_pipe = [&](size_t gi) -> VkResult {
+        if (model && pipe_res[gi] == VK_NOT_READY) {
+            auto t0 = std::chrono::steady_clock::now();
+            pipe_res[gi] = create_pipeline(C, mods, pcache, grid[gi], &pipes[gi]);
+            compile_s += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        }
+        return model || cfg.PRECOMPILE ? pipe_res[gi] : feeder.take(gi);
+    };
+    // get_pipe, with a COMPILE_FAIL record when there is none
+    auto take_pipe = [&](size_t gi) -> bool {
+        if (get_pipe(gi) != VK_SUCCESS) {
+            fprintf(stdout, "  -> [COMPILE_FAIL]\n");
+            record(gi, fail("COMPILE_FAIL"));
+            return false;
+        }
+        if (pstats[gi].empty()) pstats[gi] = pipeline_stats(C, pipes[gi]);
+        return true;
+    };
+    auto drop_pipe = [&](size_t gi){
+        if (keep_pipes) return;
+        if (pipes[gi]) vkDestroyPipeline(C.device, pipes[gi], nullptr);
+        pipes[gi] = VK_NULL_HANDLE;
+    };
+    // Launch of candidate gi on the current shape
+    auto launch = [&](size_t gi){
+        const Cand& g = grid[gi];
+        if (g.packb) ensure_packed(g);
+        return gemm_launch(C, pipes[gi], sets, g, cfg);
+    };
+    // Before a run: wait while the SoC is at TEMP_MAX or throttling, until it is
+    // 5 C cooler and unthrottled or COOLDOWN_S have passed
+    double cool_s = 0.0;
+    uint32_t n_rerun = 0;
+    auto cool_down = [&]{
+        ThermalSample t = sys_sample(probe);
+        const bool hot = cfg.TEMP_MAX > 0.0 && t.temp_c >= cfg.TEMP_MAX;
+        if (!cfg.COOLDOWN_S || (!hot && !t.throttle)) return;
+        printf("  # cooling down: %.1f C%s ...\n", t.temp_c, t.throttle ? ", throttled" : "");
+        fflush(stdout);
+        auto t0 = std::chrono::steady_clock::now();
+        double waited = 0.0;
+        while (waited < cfg.COOLDOWN_S) {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            waited = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+            t = sys_sample(probe);
+            if (!t.throttle && !(cfg.TEMP_MAX > 0.0 && t.temp_c >= cfg.TEMP_MAX - 5.0)) break;
+        }
+        cool_s += waited;
+        printf("  # %.1f C after %.0fs\n", t.temp_c, waited);
+    };
+    // Wall time spent measuring (recording, submitting, waiting on fences), with
+    // the thermal state and power around it. A run that ends hot, with the
+    // firmware throttle flags set or (without flags to read) the GPU clock 10%
+    // below the highest seen is repeated after a cooldown.
+    double gpu_mhz_max = 0.0;
+    auto timed = [&](auto&& run){
+        Meas m;
+        for (uint32_t attempt=0;; attempt++) {
+            cool_down();
+            ThermalSample t0 = sys_sample(probe);
+            power.start();
+            auto w0 = std::chrono::steady_clock::now();
+            m = run();
+            exec_s += std::chrono::duration<double>(std::chrono::steady_clock::now() - w0).count();
+            m.watts = power.stop();
+            ThermalSample t1 = sys_sample(probe);
+            m.temp_c = std::fmax(t0.temp_c, t1.temp_c);
+            m.cpu_mhz = t1.cpu_mhz; m.gpu_mhz = t1.gpu_mhz;
+            gpu_mhz_max = std::max(gpu_mhz_max, std::max(t0.gpu_mhz, t1.gpu_mhz));
+            const char* why = nullptr;
+            if (t0.throttle | t1.throttle) why = "firmware throttle flags";
+            else if (cfg.TEMP_MAX > 0.0 && m.temp_c >= cfg.TEMP_MAX) why = "temp-max reached";
+            else if (!t1.throttle_known && t1.gpu_mhz > 0.0 && t1.gpu_mhz < 0.9 * gpu_mhz_max) why = "GPU clock dropped";
+            m.throttled = why != nullptr;
+            if (!why || m.status != "OK" || attempt >= cfg.THROTTLE_RETRIES) break;
+            printf("  -> [THROTTLED] %s (%.1f C, GPU %.0f MHz), measuring again\n", why, m.temp_c, m.gpu_mhz);
+            n_rerun++;
+        }
+        return m;
+    };
+    auto report = [&](const Cand& g, const Meas& m){
+        if (m.status == "OK" && cpu_gflops > 0.0)
+            printf("  -> [OK] %s  usec=%.3f  GFLOP/s=%.6f  median=%.3f p95=%.3f cv=%.3f  (%.2fx CPU)\n",
+                cand_str(g).c_str(), m.usec, m.gflops, m.st.median, m.st.p95, m.st.cv, m.gflops / cpu_gflops);
+        else if (m.status == "OK")
+            printf("  -> [OK] %s  usec=%.3f  GFLOP/s=%.6f  median=%.3f p95=%.3f cv=%.3f\n",
+                cand_str(g).c_str(), m.usec, m.gflops, m.st.median, m.st.p95, m.st.cv);
+        else if (m.status == "PARTIAL")
+            printf("  -> [PARTIAL] %s  usec=%.3f  GFLOP/s=%.6f  (%u timed reps)\n",
+                cand_str(g).c_str(), m.usec, m.gflops, m.reps_done);
+        else if (m.status == "TIMEOUT")
+            fprintf(stdout, "  -> [TIMEOUT] after %llu ms (skipping result)\n", (unsigned long long)cfg.TIMEOUT_MS);
+        else if (m.status != "WRONG_RESULT")  // check() already printed the error summary
+            fprintf(stdout, "  -> [%s]\n", m.status.c_str());
+        if (g.cpu && m.reps_done)
+            printf("     hybrid: %u/%u rows on CPU %.3f usec, GPU %.3f usec (idle side waits %.3f usec)\n",
+                cpu_rows(g, cfg.M), cfg.M, m.cpu_usec, m.gpu_usec, std::fabs(m.cpu_usec - m.gpu_usec));
+        if (m.reps_done) {
+            std::string t;
+            if (std::isfinite(m.temp_c)) t += opt_col(m.temp_c, "  %.1f C");
+            if (m.cpu_mhz > 0.0) t += opt_col(m.cpu_mhz, "  CPU %.0f MHz");
+            if (m.gpu_mhz > 0.0) t += opt_col(m.gpu_mhz, "  GPU %.0f MHz");
+            if (std::isfinite(m.watts)) t += opt_col(m.watts, "  %.3f W") + opt_col(j_per_gflop(m), "  %.4f J/GFLOP");
+            if (m.throttled) t += "  [throttled]";
+            if (!t.empty()) printf("     thermal:%s\n", t.c_str());
+        }
+        fflush(stdout);
+    };
+
+    uint32_t n_cached=0;
+    // --search=model observations (features, log2 median usec), pooled over shapes
+    std::vector<std::vector<double>> obs_x;
+    std::vector<double> obs_y;
+    std::mt19937 model_rng(cfg.SEED);
+    // --latency: each shape's fastest GPU-only candidate on plain B, with its
+    // own pipeline, GPU median and token count (N), for the decode steps
+    struct LatShape { Launch L; VkPipeline pipe; double gpu_us; uint32_t N; };
+    std::vector<LatShape> lat;
+    for (si=0; si<shapes.size(); si++) {
+        const Shape& shape = shapes[si];
+        cfg.M = shape.M; cfg.N = shape.N; cfg.K = shape.K; cfg.BATCH = shape.batch;
+        keys = &all_keys[si];
+        const std::vector<uint8_t>& todo = all_todo[si];
+        ranked.clear();
+        pack_ms.clear();
+        if (shapes.size() > 1)
+            printf("# shape %zu/%zu %s M=%u N=%u K=%u batch=%u\n", si+1, shapes.size(), shape.name.c_str(), cfg.M, cfg.N, cfg.K, cfg.BATCH);
+        make_ref();
+
+        // Pass 1: settle candidates that need no GPU time (SMEM budget, DB) and,
+        // without halving, measure the rest
+        std::vector<size_t> alive;
+        double leader = INFINITY; // best median usec seen so far (halving)
+        uint32_t idx=0;
+        for (size_t gi : visit[si]) {
+            const Cand& g = grid[gi];
+            idx++;
+            // SMEM budget check with optional safety fraction
+            uint32_t needed_bytes = smem_bytes(g);
+            if (model) {
+                // the model search prints only what it measures
+                if (g.smem && needed_bytes > budget) { csv_row(gi, fail("SKIP_SMEM_BUDGET")); continue; }
+                if (!todo[gi]) {
+                    const Meas& m = db.recs[(*keys)[gi]].m;
+                    csv_row(gi, m);
+                    if (m.status == "OK") ranked.emplace_back(m, gi);
+                    if (m.status == "OK" && m.st.median > 0.0) { obs_x.push_back(tile_features(g, cfg, budget)); obs_y.push_back(std::log2(m.st.median)); }
+                    n_cached++;
+                    continue;
+                }
+                alive.push_back(gi);
+                continue;
+            }
+            printf("[%u/%zu] %s  ...\n",
+                idx, grid.size(), cand_str(g).c_str());
+            fflush(stdout);
+
+            if (g.smem && needed_bytes > budget) {
+                fprintf(stdout, "  -> [SKIP] needs %uB > budget %uB\n", needed_bytes, budget);
+                csv_row(gi, fail("SKIP_SMEM_BUDGET"));
+                continue;
+            }
+
+            // Resume: reuse a valid record for this exact device/driver/shader/config
+            if (!todo[gi]) {
+                const Meas& m = db.recs[(*keys)[gi]].m;
+                printf("  -> [CACHED] %s usec=%.3f  GFLOP/s=%.6f  median=%.3f\n", m.status.c_str(), m.usec, m.gflops, m.st.median);
+                csv_row(gi, m);
+                if (m.status == "OK") { leader = std::min(leader, m.st.median); ranked.emplace_back(m, gi); }
+                if (m.status == "PRUNED" && m.st.median > 0.0) est_of[si][gi] = m.st.median;
+                n_cached++;
+                continue;
+            }
+
+            // Halving takes the pipeline at the first probe instead, so that
+            // compiling still overlaps measuring and --compile-ahead holds
+            if (halving) { alive.push_back(gi); continue; }
+            if (!take_pipe(gi)) continue;
+            Launch L = launch(gi);
+            poison_c();
+            Meas m = timed([&]{ return measure(C, L, cfg, cfg.WARM, cfg.REP); });
+            check(m, L);
+            report(g, m);
+            record(gi, m);
+            drop_pipe(gi);
+        }
+
+        // Successive halving: cheap probes, prune the laggards, multiply reps by ETA
+        // for the survivors until the full REP budget is reached. Ranked by median.
+        if (halving) {
+            uint32_t reps = std::max(1u, std::min(cfg.PROBE_REP, cfg.REP));
+            uint32_t round = 0;
+            while (alive.size() > 1 && reps < cfg.REP) {
+                round++;
+                printf("# halving round %u: %zu candidates x %u reps (leader %.3f usec)\n",
+                    round, alive.size(), reps, std::isfinite(leader) ? leader : 0.0);
+                std::vector<std::pair<Meas,size_t>> probes;
+                if (any_packb) group_packed(grid, alive);
+                for (size_t gi : alive) {
+                    const Cand& g = grid[gi];
+                    printf("  [r%u] %s  ...\n", round, cand_str(g).c_str());
+                    if (!take_pipe(gi)) continue;
+                    Launch L = launch(gi);
+                    poison_c();
+                    Meas m = timed([&]{ return run_candidate(C, L, cfg, std::min(cfg.WARM, 1u), reps); });
+                    check(m, L);
+                    report(g, m);
+                    if (m.status != "OK") { record(gi, m); drop_pipe(gi); continue; }
+                    leader = std::min(leader, m.st.median);
+                    probes.emplace_back(m, gi);
+                }
+                std::sort(probes.begin(), probes.end(), [](const auto& x, const auto& y){ return x.first.st.median < y.first.st.median; });
+                size_t keep = std::max<size_t>(1, (probes.size() + cfg.ETA - 1) / cfg.ETA);
+                alive.clear();
+                for (size_t r=0;r<probes.size();r++) {
+                    auto [m, gi] = probes[r];
+                    if (r < keep && m.st.median <= cfg.PRUNE_FACTOR * leader) { alive.push_back(gi); continue; }
+                    const Cand& g = grid[gi];
+                    printf("  -> [PRUNED] %s  median=%.3f (%.2fx leader)\n",
+                        cand_str(g).c_str(), m.st.median, m.st.median / leader);
+                    m.status = "PRUNED";
+                    record(gi, m);
+                    drop_pipe(gi);
+                }
+                reps = std::min(cfg.REP, reps * cfg.ETA);
+            }
+            printf("# halving final: %zu candidates x %u reps\n", alive.size(), cfg.REP);
+            if (any_packb) group_packed(grid, alive);
+            for (size_t gi : alive) {
+                const Cand& g = grid[gi];
+                printf("  [final] %s  ...\n", cand_str(g).c_str());
+                if (!take_pipe(gi)) continue;
+                Launch L = launch(gi);
+                poison_c();
+                Meas m = timed([&]{ return measure(C, L, cfg, cfg.WARM, cfg.REP); });
+                check(m, L);
+                report(g, m);
+                record(gi, m);
+                drop_pipe(gi);
+            }
+        }
+
+        // Model-guided search: measure MODEL_INIT random candidates, then in each
+        // round refit the cost model on every measurement so far and measure the
+        // MODEL_BATCH best predicted ones (one of them random, for exploration)
+        // until the time budget runs out or nothing is left.
+        if (model) {
+            const auto m0 = std::chrono::steady_clock::now();
+            auto elapsed = [&]{ return std::chrono::duration<double>(std::chrono::steady_clock::now() - m0).count(); };
+            std::shuffle(alive.begin(), alive.end(), model_rng);
+            const size_t space = alive.size();
+            uint32_t round = 0;
+            CostModel cm;
+            std::vector<double> pred(grid.size(), 0.0);
+            while (!alive.empty() && elapsed() < cfg.MODEL_BUDGET_S) {
+                round++;
+                std::vector<size_t> pick;
+                const bool fitted = obs_x.size() >= std::max<size_t>(cfg.MODEL_INIT, 4) && cm.fit(obs_x, obs_y);
+                if (!fitted) {
+                    size_t need = obs_x.size() < cfg.MODEL_INIT ? cfg.MODEL_INIT - obs_x.size() : cfg.MODEL_BATCH;
+                    size_t n = std::min(alive.size(), need);
+                    pick.assign(alive.end() - n, alive.end());
+                    alive.resize(alive.size() - n);
+                    printf("# model round %u: %zu random candidates of %zu\n", round, pick.size(), space);
+                } else {
+                    for (size_t gi : alive) pred[gi] = cm.predict(tile_features(grid[gi], cfg, budget));
+                    std::sort(alive.begin(), alive.end(), [&](size_t a, size_t b){ return pred[a] < pred[b]; });
+                    size_t n = std::min<size_t>(alive.size(), cfg.MODEL_BATCH);
+                    size_t explore = (n > 1 && alive.size() > n) ? 1 : 0;
+                    pick.assign(alive.begin(), alive.begin() + (n - explore));
+                    alive.erase(alive.begin(), alive.begin() + (n - explore));
+                    if (explore) {
+                        size_t r = std::uniform_int_distribution<size_t>(0, alive.size() - 1)(model_rng);
+                        pick.push_back(alive[r]); alive.erase(alive.begin() + r);
+                    }
+                    double sse = 0.0;
+                    for (size_t i=0;i<obs_x.size();i++) { double e = cm.predict(obs_x[i]) - obs_y[i]; sse += e * e; }
+                    printf("# model round %u: fit on %zu points (rms error x%.2f), measuring %zu of %zu left (predicted best %.3f usec)\n",
+                        round, obs_x.size(), std::exp2(std::sqrt(sse / obs_x.size())), pick.size(), alive.size() + pick.size(),
+                        std::exp2(pred[pick[0]]));
+                }
+                if (any_packb) group_packed(grid, pick);
+                for (size_t gi : pick) {
+                    const Cand& g = grid[gi];
+                    if (fitted) printf("  [m%u] %s  predicted %.3f usec ...\n", round, cand_str(g).c_str(), std::exp2(pred[gi]));
+                    else        printf("  [m%u] %s  ...\n", round, cand_str(g).c_str());
+                    if (!take_pipe(gi)) continue;
+                    Launch L = launch(gi);
+                    poison_c();
+                    Meas m = timed([&]{ return measure(C, L, cfg, cfg.WARM, cfg.REP); });
+                    check(m, L);
+                    report(g, m);
+                    record(gi, m);
+                    drop_pipe(gi);
+                    if (m.status == "OK" && m.st.median > 0.0) { obs_x.push_back(tile_features(g, cfg, budget)); obs_y.push_back(std::log2(m.st.median)); }
+                }
+            }
+            printf("# model search: measured %zu of %zu candidates in %u rounds, %.1fs\n",
+                space - alive.size(), space, round, elapsed());
+            // Not measured: not in the DB (a later run may still pick them), in the CSV as PREDICTED
+            for (size_t gi : alive) {
+                Meas m = fail("PREDICTED");
+                if (!cm.w.empty()) m.usec = est_of[si][gi] = std::exp2(cm.predict(tile_features(grid[gi], cfg, budget)));
+                csv_row(gi, m);
+            }
+        }
+
+        // Ranking by median per-dispatch time (robust to stalls and throttling spikes)
+        std::sort(ranked.begin(), ranked.end(), [](const auto& x, const auto& y){ return x.first.st.median < y.first.st.median; });
+        for (size_t r=0; r<std::min<size_t>(ranked.size(), 5); r++) {
+            const auto& [m, gi] = ranked[r];
+            const Cand& g = grid[gi];
+            const double gf = 2.0 * double(cfg.M) * double(cfg.N) * double(cfg.K) * double(cfg.BATCH) / (m.st.median * 1e3);
+            printf("# best[%zu] %s  median=%.3f usec  p95=%.3f  cv=%.3f  GFLOP/s(median)=%.6f\n",
+                r+1, cand_str(g).c_str(), m.st.median, m.st.p95, m.st.cv, gf);
+            Roof rf = roofline(g, cfg, gf, bw_gbps, cfg.PEAK_GFLOPS);
+            if (rf.gflops > 0.0) printf("#          AI=%.2f FLOP/B  roof=%.3f GFLOP/s (%s-bound)  eff=%.1f%%%s%s\n",
+                rf.ai, rf.gflops, cfg.PEAK_GFLOPS > 0.0 && rf.gflops >= cfg.PEAK_GFLOPS ? "compute" : "memory", 100.0 * rf.eff,
+                pstats[gi].empty() ? "" : "  ", pstats[gi].c_str());
+        }
+        if (cpu_gflops > 0.0) printf("# CPU reference (%s): %.3f GFLOP/s\n", cpu_sgemm_isa(), cpu_gflops);
+        // Fused vs unfused epilogue: the unfused pass writes and re-reads M*N*B floats
+        if (cfg.EPILOGUE) {
+            double best_f = 0.0, best_u = 0.0;
+            for (const auto& [m, gi] : ranked) {
+                double& b = grid[gi].fused ? best_f : best_u;
+                if (b == 0.0) b = m.st.median;
+            }
+            if (best_f > 0.0 && best_u > 0.0)
+                printf("# epilogue %s: fused %.3f usec  unfused %.3f usec  speedup %.2fx  (unfused moves +%.1f MiB)\n",
+                    epilogue_name(cfg.EPILOGUE).c_str(), best_f, best_u, best_u / best_f,
+                    2.0 * double(cfg.M) * double(cfg.N) * double(cfg.BATCH) * sizeof(float) / (1 << 20));
+        }
+        // Hybrid: best split against the best GPU-only candidate
+        {
+            double best_gpu = 0.0, best_hyb = 0.0; size_t hyb = grid.size();
+            for (const auto& [m, gi] : ranked) {
+                if (!grid[gi].cpu) { if (best_gpu == 0.0) best_gpu = m.st.median; }
+                else if (best_hyb == 0.0) { best_hyb = m.st.median; hyb = gi; }
+            }
+            if (best_gpu > 0.0 && best_hyb > 0.0)
+                printf("# hybrid: best cpu=%u%% %.3f usec vs GPU-only %.3f usec (%.2fx)\n",
+                    grid[hyb].cpu, best_hyb, best_gpu, best_gpu / best_hyb);
+        }
+        // Perf per watt: the candidate with the least energy per GFLOP against the fastest
+        {
+            const std::pair<Meas,size_t>* eff = nullptr;
+            for (const auto& r : ranked)
+                if (std::isfinite(j_per_gflop(r.first)) && (!eff || j_per_gflop(r.first) < j_per_gflop(eff->first))) eff = &r;
+            if (eff) {
+                const Meas& m = eff->first;
+                printf("# best perf/W %s  %.4f J/GFLOP (%.3f GFLOP/s/W, %.3f W, median %.3f usec)",
+                    cand_str(grid[eff->second]).c_str(), j_per_gflop(m), 1.0 / j_per_gflop(m), m.watts, m.st.median);
+                if (std::isfinite(j_per_gflop(ranked[0].first)) && eff != &ranked[0])
+                    printf("; fastest %.4f J/GFLOP", j_per_gflop(ranked[0].first));
+                printf("\n");
+            }
+        }
+        // Packed B: best packed against the best plain candidate, the packing of
+        // its layout spread over PACK_CALLS calls
+        {
+            const std::pair<Meas,size_t> *bp = nullptr, *bu = nullptr;
+            for (const auto& r : ranked) { auto& b = grid[r.second].packb ? bp : bu; if (!b) b = &r; }
+            if (bp && bu) {
+                const double flop = 2.0 * double(cfg.M) * double(cfg.N) * double(cfg.K) * double(cfg.BATCH);
+                const double pmed = bp->first.st.median, umed = bu->first.st.median;
+                printf("# packed B: %.3f GFLOP/s (%.3f usec) vs unpacked %.3f GFLOP/s (%.3f usec), %.2fx",
+                    flop / (pmed * 1e3), pmed, flop / (umed * 1e3), umed, umed / pmed);
+                const Cand& g = grid[bp->second];
+                auto it = pack_ms.find({g.TK, g.TN});
+                if (it != pack_ms.end()) {
+                    const double per_call = it->second * 1e3 / std::max(1u, cfg.PACK_CALLS);
+                    printf("; packing %.2f ms, over %u calls +%.3f usec/call = %.2fx", it->second, cfg.PACK_CALLS, per_call, umed / (pmed + per_call));
+                    if (pmed < umed) printf(", pays off after %.0f calls", std::ceil(it->second * 1e3 / (umed - pmed)));
+                }
+                printf("\n");
+            }
+        }
+        // Latency: that candidate issued end to end, LAYERS calls a step
+        if (cfg.LATENCY && !ooc[si].on) {
+            auto it = std::find_if(ranked.begin(), ranked.end(), [&](const auto& r){
+                const Cand& g = grid[r.second]; return !g.cpu && !g.packb; });
+            if (it == ranked.end()) printf("# latency: no GPU-only candidate on plain B\n");
+            else {
+                const Cand& g = grid[it->second];
+                LatShape ls{Launch{}, VK_NULL_HANDLE, it->first.st.median, cfg.N};
+                VK_CHECK(create_pipeline(C, mods, pcache, g, &ls.pipe));
+                ls.L = gemm_launch(C, ls.pipe, sets, g, cfg);
+                cool_down();
+                LatRes r = measure_latency(C, std::vector<Launch>(cfg.LAYERS, ls.L), cfg, cfg.LATENCY);
+                if (r.status != "OK") {
+                    printf("# latency %s  [%s] after %llu ms (skipping)\n", cand_str(g).c_str(), r.status.c_str(), (unsigned long long)cfg.TIMEOUT_MS);
+                    vkDestroyPipeline(C.device, ls.pipe, nullptr);
+                } else {
+                    printf("# latency %s  GPU %.1f usec; end to end per matmul: per-call %.1f  reuse %.1f  replay %.1f  chain %.1f usec (x%u)\n",
+                        cand_str(g).c_str(), ls.gpu_us, r.percall, r.reuse, r.replay, r.chain, cfg.LAYERS);
+                    lat.push_back(ls);
+                }
+            }
+        }
+        // Throughput: the STREAM_TOP fastest single-dispatch GPU candidates with
+        // 1..S GEMMs in flight; stream_gf[gi] is the aggregate at the most streams
+        std::vector<std::pair<size_t,double>> stream_gf;
+        if (!stream_counts.empty() && !ooc[si].on) {
+            for (const auto& [m, gi] : ranked) {
+                const Cand& g = grid[gi];
+                if (g.cpu || g.packb || g.splitk > 1 || (g.epi && !g.fused)) continue;
+                if (stream_gf.size() == cfg.STREAM_TOP) break;
+                VkPipeline p; VK_CHECK(create_pipeline(C, mods, pcache, g, &p));
+                const Launch L = gemm_launch(C, p, sets, g, cfg);
+                printf("# streams %s  median %.3f usec\n", cand_str(g).c_str(), m.st.median);
+                double base = 0.0, last = 0.0;
+                uint32_t most = 0;
+                for (uint32_t n : stream_counts) {
+                    cool_down();
+                    StreamRes r = measure_streams(C, strm, L, n, cfg, cfg.REP);
+                    if (r.status != "OK") {
+                        // more streams of a kernel that already stalls only wait longer
+                        printf("#   %2u stream%s  [%s] after %llu ms (skipping the rest)\n", n, n == 1 ? " " : "s", r.status.c_str(), (unsigned long long)cfg.TIMEOUT_MS);
+                        break;
+                    }
+                    if (base == 0.0) base = r.gflops;
+                    if (n >= most) { most = n; last = r.gflops; }
+                    printf("#   %2u stream%s %10.3f GFLOP/s  x%.2f  latency p50 %.1f  p95 %.1f  p99 %.1f usec\n",
+                        n, n == 1 ? " " : "s", r.gflops, base > 0.0 ? r.gflops / base : 0.0, r.p50, r.p95, r.p99);
+                }
+                stream_gf.emplace_back(gi, last);
+                vkDestroyPipeline(C.device, p, nullptr);
+            }
+            auto top = std::max_element(stream_gf.begin(), stream_gf.end(), [](const auto& x, const auto& y){ return x.second < y.second; });
+            if (stream_gf.size() > 1 && top->second > 0.0) {
+                const uint32_t most = *std::max_element(stream_counts.begin(), stream_counts.end());
+                printf("# throughput at %u streams: best %s %.3f GFLOP/s", most, cand_str(grid[top->first]).c_str(), top->second);
+                if (top != stream_gf.begin())
+                    printf(" vs %.3f GFLOP/s for the single-stream winner (x%.2f)", stream_gf[0].second,
+                        stream_gf[0].second > 0.0 ? top->second / stream_gf[0].second : 0.0);
+                printf("\n");
+            }
+        }
+        // Out of core: the whole problem with the fastest single-pass GPU candidate
+        // on plain B
+        if (ooc[si].on) {
+            auto it = std::find_if(ranked.begin(), ranked.end(), [&](const auto& r){
+                const Cand& g = grid[r.second]; return g.splitk == 1 && !g.cpu && !g.packb; });
+            if (it == ranked.end()) printf("# out-of-core %s: no GPU-only candidate without split-K to run it\n", shape_label(full_shapes[si]).c_str());
+            else run_out_of_core(C, cfg, full_shapes[si], ooc[si], grid[it->second], mods, pcache);
+        }
+        for (const auto& [m, gi] : ranked) median_of[si][gi] = m.st.median;
+        // --rank=throughput: only the candidates run on streams compete, at the
+        // time per GEMM their aggregate throughput gives
+        if (cfg.RANK == "throughput" && !stream_gf.empty()) {
+            const double flop = 2.0 * double(cfg.M) * double(cfg.N) * double(cfg.K) * double(cfg.BATCH);
+            std::fill(median_of[si].begin(), median_of[si].end(), INFINITY);
+            std::fill(est_of[si].begin(), est_of[si].end(), INFINITY);
+            for (const auto& [gi, gf] : stream_gf) if (gf > 0.0) median_of[si][gi] = flop / (gf * 1e3);
+        }
+    } // shapes
+
+    // Latency: a decode step per token count, the shapes with that N in order as
+    // one layer, LAYERS times over; tok/s = N / step time
+    for (size_t i=0; i<lat.size(); i++) {
+        const uint32_t N = lat[i].N;
+        if (std::any_of(lat.begin(), lat.begin() + i, [&](const LatShape& l){ return l.N == N; })) continue;
+        std::vector<Launch> step;
+        double gpu_us = 0.0;
+        for (uint32_t l=0; l<cfg.LAYERS; l++)
+            for (const LatShape& ls : lat)
+                if (ls.N == N) { step.push_back(ls.L); gpu_us += ls.gpu_us; }
+        cool_down();
+        LatRes r = measure_latency(C, step, cfg, cfg.LATENCY);
+        const double n = double(step.size());
+        printf("# decode step N=%u: %zu matmuls (%zu per layer x %u layers)\n", N, step.size(), step.size() / cfg.LAYERS, cfg.LAYERS);
+        if (r.status != "OK") {
+            printf("#   [%s] after %llu ms (skipping)\n", r.status.c_str(), (unsigned long long)cfg.TIMEOUT_MS);
+            continue;
+        }
+        auto row = [&](const char* how, double us){
+            printf("#   %-8s %8.1f usec/matmul  %10.1f usec/step  %9.1f tok/s\n", how, us, us * n, N * 1e6 / (us * n));
+        };
+        row("GPU", gpu_us / n);
+        row("per-call", r.percall);
+        row("reuse", r.reuse);
+        row("replay", r.replay);
+        row("chain", r.chain);
     }
+    for (const LatShape& ls : lat) vkDestroyPipeline(C.device, ls.pipe, nullptr);
+
+    if (shapes.size() > 1 || !cfg.WINNERS.empty()) print_winners(shapes, grid, median_of, est_of, C.subprops.subgroupSize, cfg.WINNERS);
+    feeder.finish();
+    for (size_t gi=0; gi<grid.size(); gi++) if (pipes[gi]) vkDestroyPipeline(C.device, pipes[gi], nullptr);
+
+    // Where the time went: with --precompile=0 compiling overlaps execution, so
+    // wall ~ max(compile, execute) + waited rather than their sum
+    double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_t0).count();
+    if (!cfg.PRECOMPILE && !model) compile_s = feeder.compile_s;
+    printf("# time: wall %.2fs  compile %.2fs (%s)  execute %.2fs  waited on compiler %.2fs\n",
+        wall_s, compile_s, model ? "on demand" : cfg.PRECOMPILE ? "precompiled" : "background", exec_s, feeder.wait_s);
 
     if (csv) fclose(csv);
+    if (db.out) fclose(db.out);
+    save_pipeline_cache(C, pcache, cfg.PIPELINE_CACHE);
+    vkDestroyPipelineCache(C.device, pcache, nullptr);
+    if (n_rerun || cool_s > 0.0) fprintf(stderr, "# thermal: %u throttled runs measured again, %.0fs spent cooling down\n", n_rerun, cool_s);
+    if (n_cached) fprintf(stderr, "# resumed %u/%zu candidates from %s\n", n_cached, grid.size() * shapes.size(), cfg.DB.c_str());
 
     // Cleanup
-    vkDestroyShaderModule(C.device, mod, nullptr);
-    vkDestroyBuffer(C.device, C.bufA, nullptr);
-    vkDestroyBuffer(C.device, C.bufB, nullptr);
-    vkDestroyBuffer(C.device, C.bufC, nullptr);
-    vkFreeMemory(C.device, C.memA, nullptr);
-    vkFreeMemory(C.device, C.memB, nullptr);
-    vkFreeMemory(C.device, C.memC, nullptr);
-    vkDestroyDescriptorPool(C.device, C.dpool, nullptr);
-    vkDestroyPipelineLayout(C.device, C.ppl, nullptr);
-    vkDestroyDescriptorSetLayout(C.device, C.dsl, nullptr);
+    for (VkShaderModule md : mods) if (md) vkDestroyShaderModule(C.device, md, nullptr);
+    if (sets.reduce_pipe) vkDestroyPipeline(C.device, sets.reduce_pipe, nullptr);
+    if (sets.epi_pipe) vkDestroyPipeline(C.device, sets.epi_pipe, nullptr);
+    if (reduce_mod) vkDestroyShaderModule(C.device, reduce_mod, nullptr);
+    if (!stream_counts.empty()) destroy_streams(C, strm);
+    destroy_arena(C, C.arena, abc);
     vkDestroyQueryPool(C.device, C.qpool, nullptr);
-    vkDestroyCommandPool(C.device, C.cpool, nullptr);
-    vkDestroyDevice(C.device, nullptr);
-    vkDestroyInstance(C.instance, nullptr);
+    destroy_vulkan(C);
     return 0;
 }
@@ -0,0 +1,167 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 davidscarth
+ */
+
+#include "quant.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <strings.h>
+
+namespace {
+
+constexpr uint32_t QK4_0 = 32, QK8_0 = 32, QK_K = 256, K_SCALE_SIZE = 12;
+
+uint32_t kquant_bits(QType t) { return t == QType::Q4_K ? 4u : 6u; }
+
+// Write `bits` of v at bit offset `bit` of a little-endian uint32 stream
+void put_bits(uint32_t* w, uint32_t bit, uint32_t bits, uint32_t v) {
+    uint32_t i = bit >> 5, sh = bit & 31u;
+    w[i] |= v << sh;
+    if (sh + bits > 32u) w[i+1] |= v >> (32u - sh);
+}
+
+void quant_q4_0(QuantBlob& q, const float* x, uint32_t blk) {
+    // ggml-style: the largest-magnitude element maps to -8
+    float amax = 0.0f, mx = 0.0f;
+    for (uint32_t i=0;i<QK4_0;i++) if (std::fabs(x[i]) > amax) { amax = std::fabs(x[i]); mx = x[i]; }
+    float d = mx / -8.0f, id = d != 0.0f ? 1.0f / d : 0.0f;
+    q.sc[blk] = d;
+    uint32_t* w = q.qs.data() + (size_t)blk * (QK4_0 / 8);
+    for (uint32_t i=0;i<QK4_0;i++) {
+        int v = std::min(15, std::max(0, (int)std::lround(x[i] * id) + 8));
+        w[i >> 3] |= uint32_t(v) << ((i & 7u) * 4u);
+    }
+}
+
+void quant_q8_0(QuantBlob& q, const float* x, uint32_t blk) {
+    float amax = 0.0f;
+    for (uint32_t i=0;i<QK8_0;i++) amax = std::max(amax, std::fabs(x[i]));
+    float d = amax / 127.0f, id = d != 0.0f ? 1.0f / d : 0.0f;
+    q.sc[blk] = d;
+    uint32_t* w = q.qs.data() + (size_t)blk * (QK8_0 / 4);
+    for (uint32_t i=0;i<QK8_0;i++) {
+        int v = std::min(127, std::max(-127, (int)std::lround(x[i] * id)));
+        w[i >> 2] |= uint32_t(uint8_t(int8_t(v))) << ((i & 3u) * 8u);
+    }
+}
+
+// Asymmetric per-sub-block quantization: q=0 maps to the sub-block minimum
+void quant_k(QuantBlob& q, const float* x, uint32_t blk) {
+    const uint32_t bits = kquant_bits(q.type), qmax = (1u << bits) - 1u;
+    const float zp = float(1u << (bits - 1u));
+    uint32_t* w = q.qs.data() + (size_t)blk * (q.block_sz_q / 4);
+    for (uint32_t sub=0; sub<K_SCALE_SIZE; sub++) {
+        uint32_t e0 = (sub * QK_K + K_SCALE_SIZE - 1) / K_SCALE_SIZE;  // first e with e*12/256 == sub
+        uint32_t e1 = ((sub + 1) * QK_K + K_SCALE_SIZE - 1) / K_SCALE_SIZE;
+        float lo = x[e0], hi = x[e0];
+        for (uint32_t e=e0; e<e1; e++) { lo = std::min(lo, x[e]); hi = std::max(hi, x[e]); }
+        float scale = (hi - lo) / float(qmax), iscale = scale != 0.0f ? 1.0f / scale : 0.0f;
+        q.sc[(size_t)blk * K_SCALE_SIZE + sub] = scale;
+        q.mn[(size_t)blk * K_SCALE_SIZE + sub] = lo + scale * zp;
+        for (uint32_t e=e0; e<e1; e++) {
+            uint32_t v = (uint32_t)std::min<long>(qmax, std::max<long>(0, std::lround((x[e] - lo) * iscale)));
+            put_bits(w, e * bits, bits, v);
+        }
+    }
+}
+
+float dequant(const QuantBlob& q, uint32_t row, uint32_t k) {
+    switch (q.type) {
+    case QType::Q4_0: {
+        uint32_t blk = row * q.blocks_per_row + k / QK4_0, e = k % QK4_0;
+        uint32_t w = q.qs[(size_t)blk * (QK4_0 / 8) + (e >> 3)];
+        return q.sc[blk] * (float((w >> ((e & 7u) * 4u)) & 0xFu) - 8.0f);
+    }
+    case QType::Q8_0: {
+        uint32_t blk = row * q.blocks_per_row + k / QK8_0, e = k % QK8_0;
+        uint32_t w = q.qs[(size_t)blk * (QK8_0 / 4) + (e >> 2)];
+        return q.sc[blk] * float(int8_t(uint8_t(w >> ((e & 3u) * 8u))));
+    }
+    case QType::Q4_K: case QType::Q6_K: {
+        const uint32_t bits = kquant_bits(q.type);
+        uint32_t blk = row * q.blocks_per_row + k / QK_K, e = k % QK_K, sub = e * K_SCALE_SIZE / QK_K;
+        const uint32_t* w = q.qs.data() + (size_t)blk * (q.block_sz_q / 4);
+        uint32_t bit = e * bits, i = bit >> 5, sh = bit & 31u;
+        uint64_t win = w[i] | (sh + bits > 32u ? uint64_t(w[i+1]) << 32 : 0);
+        uint32_t v = uint32_t(win >> sh) & ((1u << bits) - 1u);
+        size_t si = (size_t)blk * K_SCALE_SIZE + sub;
+        return q.sc[si] * (float(v) - float(1u << (bits - 1u))) + q.mn[si];
+    }
+    default: return 0.0f;
+    }
+}
+
+} // namespace
+
+size_t QuantBlob::weight_bytes() const {
+    if (type == QType::F32) return (size_t)M * K * sizeof(float);
+    return qs.size() * 4 + sc.size() * 4 + mn.size() * 4;
+}
+
+QuantBlob quantize(QType t, const float* A, uint32_t M, uint32_t K) {
+    QuantBlob q;
+    q.type = t; q.M = M; q.K = K;
+    if (t == QType::F32) {
+        q.deq.assign(A, A + (size_t)M * K);
+        return q;
+    }
+    const uint32_t qk = (t == QType::Q4_0) ? QK4_0 : (t == QType::Q8_0) ? QK8_0 : QK_K;
+    q.blocks_per_row = (K + qk - 1) / qk;
+    q.block_sz_q = (t == QType::Q4_0) ? QK4_0 / 2 : (t == QType::Q8_0) ? QK8_0 : QK_K * kquant_bits(t) / 8;
+    const size_t nblk = (size_t)M * q.blocks_per_row;
+    q.qs.assign(nblk * q.block_sz_q / 4, 0u);
+    const bool kq = (t == QType::Q4_K || t == QType::Q6_K);
+    q.sc.assign(nblk * (kq ? K_SCALE_SIZE : 1u), 0.0f);
+    if (kq) q.mn.assign(nblk * K_SCALE_SIZE, 0.0f);
+
+    std::vector<float> x(qk);
+    for (uint32_t r=0;r<M;r++) {
+        for (uint32_t b=0;b<q.blocks_per_row;b++) {
+            for (uint32_t i=0;i<qk;i++) {
+                uint32_t k = b * qk + i;
+                x[i] = k < K ? A[(size_t)r * K + k] : 0.0f;
+            }
+            uint32_t blk = r * q.blocks_per_row + b;
+            if (t == QType::Q4_0) quant_q4_0(q, x.data(), blk);
+            else if (t == QType::Q8_0) quant_q8_0(q, x.data(), blk);
+            else quant_k(q, x.data(), blk);
+        }
+    }
+    q.deq.resize((size_t)M * K);
+    for (uint32_t r=0;r<M;r++)
+        for (uint32_t k=0;k<K;k++) q.deq[(size_t)r * K + k] = dequant(q, r, k);
+    return q;
+}
+
+const char* qtype_name(QType t) {
+    switch (t) {
+    case QType::F32:  return "f32";
+    case QType::Q4_0: return "q4_0";
+    case QType::Q8_0: return "q8_0";
+    case QType::Q4_K: return "q4_k";
+    case QType::Q6_K: return "q6_k";
+    }
+    return "?";
+}
+
+bool parse_qtype(const char* s, QType& t) {
+    for (QType c : {QType::F32, QType::Q4_0, QType::Q8_0, QType::Q4_K, QType::Q6_K})
+        if (!strcasecmp(s, qtype_name(c))) { t = c; return true; }
+    return false;
+}
+
+uint32_t qtype_shader_id(QType t) {
+    switch (t) {
+    case QType::Q8_0: return 1;  // QX family: 0=Q4_0, 1=Q8_0
+    case QType::Q6_K: return 2;  // K family:  0=Q4_K, 2=Q6_K
+    default:          return 0;
+    }
+}
+
+std::vector<float> block_sums(const float* b, uint32_t K) {
+    std::vector<float> s((K + QK_K - 1) / QK_K, 0.0f);
+    for (uint32_t k=0;k<K;k++) s[k / QK_K] += b[k];
+    return s;
+}
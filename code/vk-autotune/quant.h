@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 davidscarth
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Weight formats understood by code/low-smem-shaders. The bit layouts follow
+// those shaders (not ggml's on-disk structs):
+//   Q4_0 / Q8_0: 32-element blocks, element i at nibble/byte i of the block's
+//                uint32 words (little-endian), one float scale per block,
+//                value = scale * (q - 8) for Q4_0, scale * int8(q) for Q8_0.
+//   Q4_K / Q6_K: 256-element blocks, codes packed LSB-first at bit e*bits,
+//                12 sub-blocks (sub = e*12/256) with a float scale and min each,
+//                value = scale * (q - 2^(bits-1)) + min.
+enum class QType { F32, Q4_0, Q8_0, Q4_K, Q6_K };
+
+struct QuantBlob {
+    QType    type = QType::F32;
+    uint32_t M = 0, K = 0;
+    uint32_t blocks_per_row = 0;
+    uint32_t block_sz_q = 0;        // payload bytes per block
+    std::vector<uint32_t> qs;       // packed codes
+    std::vector<float> sc, mn;      // per-(sub)block scales / mins (mn only for K-quants)
+    std::vector<float> deq;         // dequantized M x K (row-major), the CPU reference weights
+
+    // Bytes a kernel has to stream to read the weights once
+    size_t weight_bytes() const;
+};
+
+// Quantize row-major A[M x K]; K is zero-padded up to a whole block.
+QuantBlob quantize(QType t, const float* A, uint32_t M, uint32_t K);
+
+const char* qtype_name(QType t);
+bool parse_qtype(const char* s, QType& t);
+
+// TYPE_ID spec constant / push value the low-SMEM shaders expect
+uint32_t qtype_shader_id(QType t);
+
+// Σ(b) per 256-element block, as computed by block_sum_b.comp
+std::vector<float> block_sums(const float* b, uint32_t K);
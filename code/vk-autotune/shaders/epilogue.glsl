@@ -0,0 +1,21 @@
+// Fused GEMM epilogue, shared by gemm.comp, gemm_v2.comp and reduce_epilogue.comp:
+//   C = act(alpha * acc + beta * C + bias[col])
+// Each term is compiled in only when its spec constant is set, so EPI_* = 0
+// leaves the plain C = acc store.
+layout(constant_id = 16) const uint EPI_ACT = 0u;    // 0 none, 1 ReLU, 2 SiLU, 3 GELU (tanh form, as ggml)
+layout(constant_id = 17) const uint EPI_BIAS = 0u;   // 1: add bias[col] from binding 3
+layout(constant_id = 18) const uint EPI_SCALE = 0u;  // 1: alpha/beta from push constants, reads C (read-modify-write)
+
+layout(set=0, binding=3, std430) readonly buffer BiasBuf { float Bias[]; };
+
+bool epi_reads_c() { return EPI_SCALE != 0u; }
+
+float epilogue(float acc, float c_old, uint col, float alpha, float beta) {
+    float v = acc;
+    if (EPI_SCALE != 0u) v = alpha * v + beta * c_old;
+    if (EPI_BIAS != 0u) v += Bias[col];
+    if (EPI_ACT == 1u) v = max(v, 0.0);
+    else if (EPI_ACT == 2u) v = v / (1.0 + exp(-v));
+    else if (EPI_ACT == 3u) v = 0.5 * v * (1.0 + tanh(0.7978845608 * (v + 0.044715 * v * v * v)));
+    return v;
+}
@@ -0,0 +1,56 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 davidscarth
+ */
+// best_for over a group of shapes where a halving search pruned a different
+// candidate on each shape, so no candidate has a full measurement on all of them
+
+#include "winners.h"
+
+#include <cmath>
+#include <cstdio>
+
+static int failures = 0;
+#define EXPECT(cond) do { if (!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+int main() {
+    const double X = INFINITY;
+    // 3 shapes x 3 candidates; candidate s was pruned on shape s
+    const ShapeTimes med = {
+        {    X, 10.0, 12.0 },
+        { 20.0,    X, 21.0 },
+        { 30.0, 33.0,    X },
+    };
+    const ShapeTimes est = {
+        { 11.0,    X,    X },
+        {    X, 30.0,    X },
+        {    X,    X, 40.0 },
+    };
+    const std::vector<size_t> all = {0, 1, 2};
+
+    // Full measurements alone cover no candidate on every shape
+    GroupPick p = best_for(all, 3, med, nullptr);
+    EXPECT(p.gi == 3);
+    EXPECT(std::isinf(p.slowdown));
+
+    // With the probe medians: mean slowdowns 1.037, 1.233, 1.178
+    p = best_for(all, 3, med, &est);
+    EXPECT(p.gi == 0);
+    EXPECT(p.estimated == 1);
+    EXPECT(std::fabs(p.slowdown - (11.0 / 10.0 + 20.0 / 20.0 + 30.0 / 30.0) / 3.0) < 1e-12);
+
+    // A single shape: the per-shape winner comes from full measurements only
+    p = best_for({1}, 3, med, &est);
+    EXPECT(p.gi == 0);
+    EXPECT(p.estimated == 0);
+    EXPECT(p.slowdown == 1.0);
+
+    // A shape with nothing fully measured leaves the group uncovered
+    ShapeTimes med2 = med;
+    med2[2] = {X, X, X};
+    p = best_for(all, 3, med2, &est);
+    EXPECT(p.gi == 3);
+
+    if (failures) return 1;
+    printf("winners_test: OK\n");
+    return 0;
+}
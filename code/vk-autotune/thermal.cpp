@@ -0,0 +1,187 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 davidscarth
+ */
+#include "thermal.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+
+// First number in a sysfs file; false if it cannot be read
+static bool read_num(const std::string& path, double* v, int base = 10) {
+    FILE* f = fopen(path.c_str(), "r");
+    if (!f) return false;
+    char buf[64] = {};
+    bool ok = fgets(buf, sizeof(buf), f) != nullptr;
+    fclose(f);
+    if (!ok) return false;
+    char* end = nullptr;
+    double x = base == 10 ? strtod(buf, &end) : (double)strtoull(buf, &end, base);
+    if (end == buf) return false;
+    *v = x;
+    return true;
+}
+
+static std::string read_line(const std::string& path) {
+    FILE* f = fopen(path.c_str(), "r");
+    if (!f) return "";
+    char buf[128] = {};
+    if (!fgets(buf, sizeof(buf), f)) buf[0] = 0;
+    fclose(f);
+    std::string s = buf;
+    while (!s.empty() && (s.back() == '\n' || s.back() == ' ')) s.pop_back();
+    return s;
+}
+
+// Entries of `dir` starting with `prefix`, sorted
+static std::vector<std::string> list_dir(const std::string& dir, const char* prefix) {
+    std::vector<std::string> out;
+    DIR* d = opendir(dir.c_str());
+    if (!d) return out;
+    while (dirent* e = readdir(d))
+        if (!strncmp(e->d_name, prefix, strlen(prefix))) out.push_back(e->d_name);
+    closedir(d);
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+static bool readable(const std::string& path) { double v; return read_num(path, &v); }
+
+SysProbe sys_probe() {
+    SysProbe p;
+    for (const std::string& z : list_dir("/sys/class/thermal", "thermal_zone")) {
+        std::string f = "/sys/class/thermal/" + z + "/temp";
+        if (readable(f)) p.zones.push_back(f);
+    }
+    const char* cpu = "/sys/devices/system/cpu/cpu0/cpufreq/scaling_cur_freq";
+    if (readable(cpu)) p.cpu_freq = cpu;
+    // GPU clock: a devfreq device that looks like a GPU, else the V3D clock in
+    // debugfs (Raspberry Pi, readable as root)
+    for (const std::string& d : list_dir("/sys/class/devfreq", "")) {
+        if (d[0] == '.') continue;
+        std::string lower = d;
+        for (char& c : lower) c = (char)tolower((unsigned char)c);
+        std::string f = "/sys/class/devfreq/" + d + "/cur_freq";
+        if ((lower.find("gpu") != std::string::npos || lower.find("v3d") != std::string::npos ||
+             lower.find("mali") != std::string::npos || lower.find("kgsl") != std::string::npos) && readable(f)) {
+            p.gpu_freq = f; break;
+        }
+    }
+    for (const char* f : {"/sys/kernel/debug/clk/v3d/clk_rate", "/sys/kernel/debug/clk/fw-clk-v3d/clk_rate"})
+        if (p.gpu_freq.empty() && readable(f)) p.gpu_freq = f;
+    for (const char* f : {"/sys/devices/platform/soc/soc:firmware/get_throttled",
+                          "/sys/devices/platform/axi/axi:firmware/get_throttled"})
+        if (p.throttled.empty() && readable(f)) p.throttled = f;
+    return p;
+}
+
+std::string SysProbe::describe() const {
+    std::string s = std::to_string(zones.size()) + " thermal zone" + (zones.size() == 1 ? "" : "s");
+    s += cpu_freq.empty() ? ", no CPU clock" : ", CPU clock";
+    s += gpu_freq.empty() ? ", no GPU clock" : ", GPU clock " + gpu_freq;
+    s += throttled.empty() ? ", no throttle flags" : ", firmware throttle flags";
+    return s;
+}
+
+ThermalSample sys_sample(const SysProbe& p) {
+    ThermalSample t;
+    double v;
+    for (const std::string& z : p.zones)
+        if (read_num(z, &v) && (std::isnan(t.temp_c) || v / 1000.0 > t.temp_c)) t.temp_c = v / 1000.0;
+    if (!p.cpu_freq.empty() && read_num(p.cpu_freq, &v)) t.cpu_mhz = v / 1000.0;
+    if (!p.gpu_freq.empty() && read_num(p.gpu_freq, &v)) t.gpu_mhz = v / 1e6;
+    if (!p.throttled.empty() && read_num(p.throttled, &v, 16)) {
+        t.throttle = (uint32_t)v & kThrottleNow;
+        t.throttle_known = true;
+    }
+    return t;
+}
+
+// ---------------------------------------------------------------------------
+// PowerMeter
+// ---------------------------------------------------------------------------
+PowerMeter::PowerMeter(const std::string& dir) {
+    if (dir == "none") return;
+    std::vector<std::string> dirs;
+    if (!dir.empty()) dirs.push_back(dir);
+    else for (const std::string& h : list_dir("/sys/class/hwmon", "hwmon")) dirs.push_back("/sys/class/hwmon/" + h);
+    double v;
+    for (const std::string& d : dirs) {
+        if (read_num(d + "/energy1_input", &v)) { kind_ = Energy; file_a_ = d + "/energy1_input"; }
+        else if (read_num(d + "/power1_input", &v)) { kind_ = Power; file_a_ = d + "/power1_input"; }
+        else if (read_num(d + "/power1_average", &v)) { kind_ = Power; file_a_ = d + "/power1_average"; }
+        else if (read_num(d + "/in1_input", &v) && read_num(d + "/curr1_input", &v)) {
+            kind_ = VoltAmp; file_a_ = d + "/in1_input"; file_b_ = d + "/curr1_input";
+        }
+        if (kind_ != None) { dir_ = d; name_ = read_line(d + "/name"); break; }
+    }
+    if (kind_ == None && !dir.empty()) fprintf(stderr, "# power: no energy/power/voltage+current sensor in %s\n", dir.c_str());
+}
+
+PowerMeter::~PowerMeter() {
+    run_ = false;
+    if (th_.joinable()) th_.join();
+}
+
+std::string PowerMeter::describe() const {
+    if (kind_ == None) return "";
+    std::string s = dir_.substr(dir_.rfind('/') + 1);
+    if (!name_.empty()) s += " (" + name_ + ")";
+    s += " " + file_a_.substr(file_a_.rfind('/') + 1);
+    if (kind_ == VoltAmp) s += " x " + file_b_.substr(file_b_.rfind('/') + 1);
+    return s;
+}
+
+double PowerMeter::read_watts() const {
+    double a = 0.0, b = 0.0;
+    if (kind_ == Power) return read_num(file_a_, &a) ? a * 1e-6 : NAN;
+    if (kind_ == VoltAmp) return read_num(file_a_, &a) && read_num(file_b_, &b) ? a * b * 1e-6 : NAN;
+    return NAN;
+}
+
+double PowerMeter::read_joules() const {
+    double e = 0.0;
+    return read_num(file_a_, &e) ? e * 1e-6 : NAN;
+}
+
+void PowerMeter::sample() {
+    double w = read_watts();
+    if (!std::isfinite(w)) return;
+    std::lock_guard<std::mutex> lk(mu_);
+    sum_ += w; n_++;
+}
+
+void PowerMeter::start() {
+    if (kind_ == None) return;
+    t0_ = std::chrono::steady_clock::now();
+    if (kind_ == Energy) { e0_ = read_joules(); return; }
+    if (th_.joinable()) { run_ = false; th_.join(); }
+    sum_ = 0.0; n_ = 0;
+    run_ = true;
+    // one reading at each end, so even a run shorter than the period has two
+    sample();
+    th_ = std::thread([this]{
+        for (;;) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            if (!run_) break;
+            sample();
+        }
+    });
+}
+
+double PowerMeter::stop() {
+    if (kind_ == None) return NAN;
+    if (kind_ == Energy) {
+        double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0_).count();
+        double e1 = read_joules();
+        // a counter that wrapped or did not move in a very short interval says nothing
+        return s > 0.0 && e1 > e0_ ? (e1 - e0_) / s : NAN;
+    }
+    run_ = false;
+    if (th_.joinable()) th_.join();
+    sample();
+    std::lock_guard<std::mutex> lk(mu_);
+    return n_ ? sum_ / n_ : NAN;
+}
@@ -0,0 +1,77 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 davidscarth
+ */
+#pragma once
+
+// Thermal, clock and power state of the board from Linux sysfs, read around
+// every measured candidate so a throttled measurement can be spotted and
+// repeated. Everything is optional: missing files read as "unknown".
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Raspberry Pi firmware get_throttled bits that slow the chip down right now:
+// 1 ARM frequency capped, 2 throttled, 3 soft temperature limit. Bit 0
+// (under-voltage) is a supply problem no cooldown fixes, and bits 16-19 are
+// sticky "has occurred" flags.
+constexpr uint32_t kThrottleNow = 0xE;
+
+struct ThermalSample {
+    double temp_c = NAN;        // hottest /sys/class/thermal zone
+    double cpu_mhz = 0.0;       // cpu0 scaling_cur_freq (0 = unknown)
+    double gpu_mhz = 0.0;       // GPU devfreq / V3D clock (0 = unknown)
+    uint32_t throttle = 0;      // get_throttled & kThrottleNow
+    bool throttle_known = false;
+};
+
+// The files sys_sample() reads, found once at startup
+struct SysProbe {
+    std::vector<std::string> zones;     // thermal_zone*/temp, millidegrees C
+    std::string cpu_freq;               // kHz
+    std::string gpu_freq;               // Hz
+    std::string throttled;              // hex flags
+    std::string describe() const;       // one line for the banner
+};
+
+SysProbe sys_probe();
+ThermalSample sys_sample(const SysProbe& p);
+
+// Mean board/SoC power over an interval from a hwmon sensor: energy1_input
+// (uJ, differenced), else power1_input / power1_average (uW) or in1_input x
+// curr1_input (mV x mA), sampled every 20 ms by a background thread.
+// `dir` = "" picks the first hwmon with one of these, "none" disables.
+class PowerMeter {
+public:
+    explicit PowerMeter(const std::string& dir = "");
+    ~PowerMeter();
+    PowerMeter(const PowerMeter&) = delete;
+    PowerMeter& operator=(const PowerMeter&) = delete;
+
+    bool available() const { return kind_ != None; }
+    std::string describe() const;       // "hwmon3 (ina226) power1_input" or ""
+
+    void start();
+    double stop();                      // mean watts since start(), NaN without a sensor
+
+private:
+    enum Kind { None, Energy, Power, VoltAmp };
+    double read_watts() const;          // Power / VoltAmp: instantaneous
+    double read_joules() const;         // Energy: counter
+    void sample();                      // add one read_watts() to the mean
+
+    Kind kind_ = None;
+    std::string dir_, name_, file_a_, file_b_;
+    std::chrono::steady_clock::time_point t0_;
+    double e0_ = 0.0;
+    std::thread th_;
+    std::atomic<bool> run_{false};
+    std::mutex mu_;
+    double sum_ = 0.0;
+    uint32_t n_ = 0;
+};
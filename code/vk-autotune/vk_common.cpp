@@ -0,0 +1,418 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 davidscarth
+ */
+
+#include "vk_common.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#ifndef VK_AT_COMPILE_TOOL
+#define VK_AT_COMPILE_TOOL "unknown"
+#endif
+
+std::vector<uint32_t> load_spirv(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f) { perror(path); std::exit(1); }
+    fseek(f,0,SEEK_END); long sz = ftell(f); fseek(f,0,SEEK_SET);
+    std::vector<uint32_t> buf((sz+3)/4);
+    size_t rd = fread(buf.data(),1,sz,f); (void)rd; fclose(f);
+    return buf;
+}
+
+std::string mem_type_desc(const MemArena& a) {
+    std::string s = std::to_string(a.type);
+    const char* sep = ":";
+    auto add = [&](VkMemoryPropertyFlags bit, const char* name){ if (a.flags & bit) { s += sep; s += name; sep = "|"; } };
+    add(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, "DL");
+    add(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, "HV");
+    add(VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, "HC");
+    add(VK_MEMORY_PROPERTY_HOST_CACHED_BIT, "HCa");
+    return s;
+}
+
+uint32_t find_memory_type(const VulkanCtx& C, uint32_t bits, VkMemoryPropertyFlags want, VkMemoryPropertyFlags avoid) {
+    uint32_t fallback = UINT32_MAX;
+    for (uint32_t i=0;i<C.memprops.memoryTypeCount;i++) {
+        VkMemoryPropertyFlags f = C.memprops.memoryTypes[i].propertyFlags;
+        if (!(bits & (1u<<i)) || (f & want) != want) continue;
+        if (!(f & avoid)) return i;
+        if (fallback == UINT32_MAX) fallback = i;
+    }
+    return fallback;
+}
+
+// pick_memory_type, UINT32_MAX when nothing host-coherent is left to fall back on
+static uint32_t placement_type(const VulkanCtx& C, uint32_t bits, MemPlace p) {
+    const VkMemoryPropertyFlags HV = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, HC = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    uint32_t idx = UINT32_MAX;
+    if (p == MemPlace::Device) idx = find_memory_type(C, bits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, HV);
+    if (p == MemPlace::Cached) idx = find_memory_type(C, bits, HV | VK_MEMORY_PROPERTY_HOST_CACHED_BIT, 0);
+    if (idx == UINT32_MAX) {
+        if (p != MemPlace::Coherent) fprintf(stderr, "# --mem=%s: no matching memory type, using host-coherent\n", mem_place_name(p));
+        idx = find_memory_type(C, bits, HV | HC, 0);
+    }
+    return idx;
+}
+
+uint32_t pick_memory_type(const VulkanCtx& C, uint32_t bits, MemPlace p) {
+    uint32_t idx = placement_type(C, bits, p);
+    if (idx == UINT32_MAX) { fprintf(stderr,"No HOST_VISIBLE|HOST_COHERENT memory found\n"); std::exit(1); }
+    return idx;
+}
+
+MemArena create_arena(const VulkanCtx& C, MemPlace p, const std::vector<GpuBuf*>& bufs) {
+    MemArena a;
+    VkResult r = try_create_arena(C, p, bufs, &a);
+    if (r == VK_ERROR_FEATURE_NOT_PRESENT) { fprintf(stderr,"No HOST_VISIBLE|HOST_COHERENT memory found\n"); std::exit(1); }
+    VK_CHECK(r);
+    return a;
+}
+
+VkResult try_create_arena(const VulkanCtx& C, MemPlace p, const std::vector<GpuBuf*>& bufs, MemArena* out) {
+    MemArena a;
+    auto fail = [&](VkResult r){ destroy_arena(C, a, bufs); return r; };
+    uint32_t bits = ~0u;
+    std::vector<VkMemoryRequirements> mr(bufs.size());
+    for (size_t i=0;i<bufs.size();i++) {
+        VkBufferCreateInfo bi{VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+        bi.size = bufs[i]->size;
+        bi.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        bi.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        if (VkResult r = vkCreateBuffer(C.device, &bi, nullptr, &bufs[i]->buf)) return fail(r);
+        vkGetBufferMemoryRequirements(C.device, bufs[i]->buf, &mr[i]);
+        bits &= mr[i].memoryTypeBits;
+        bufs[i]->offset = (a.size + mr[i].alignment - 1) / mr[i].alignment * mr[i].alignment;
+        a.size = bufs[i]->offset + mr[i].size;
+    }
+    a.type = placement_type(C, bits, p);
+    if (a.type == UINT32_MAX) return fail(VK_ERROR_FEATURE_NOT_PRESENT);
+    a.flags = C.memprops.memoryTypes[a.type].propertyFlags;
+
+    VkMemoryAllocateInfo ai{VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
+    ai.allocationSize = a.size;
+    ai.memoryTypeIndex = a.type;
+    if (VkResult r = vkAllocateMemory(C.device, &ai, nullptr, &a.mem)) return fail(r);
+    // Device placement always goes through staging, even on unified memory
+    if (p != MemPlace::Device && (a.flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)) {
+        void* m;
+        if (VkResult r = vkMapMemory(C.device, a.mem, 0, VK_WHOLE_SIZE, 0, &m)) return fail(r);
+        a.map = (uint8_t*)m;
+    }
+    for (GpuBuf* b : bufs) {
+        if (VkResult r = vkBindBufferMemory(C.device, b->buf, a.mem, b->offset)) return fail(r);
+        b->map = a.map ? a.map + b->offset : nullptr;
+    }
+    *out = a;
+    return VK_SUCCESS;
+}
+
+void destroy_arena(const VulkanCtx& C, MemArena& a, const std::vector<GpuBuf*>& bufs) {
+    for (GpuBuf* b : bufs) { if (b->buf) vkDestroyBuffer(C.device, b->buf, nullptr); *b = GpuBuf{}; }
+    if (a.mem) { if (a.map) vkUnmapMemory(C.device, a.mem); vkFreeMemory(C.device, a.mem, nullptr); }
+    a = MemArena{};
+}
+
+void ensure_staging(VulkanCtx& C, VkDeviceSize bytes) {
+    if (C.staging.size >= bytes) return;
+    std::vector<GpuBuf*> sb{&C.staging};
+    destroy_arena(C, C.staging_arena, sb);
+    C.staging.size = bytes;
+    C.staging_arena = create_arena(C, MemPlace::Coherent, sb);
+}
+
+void flush_arena(const VulkanCtx& C, const MemArena& a) {
+    if (!a.map || (a.flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) return;
+    VkMappedMemoryRange r{VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE}; r.memory = a.mem; r.offset = 0; r.size = VK_WHOLE_SIZE;
+    VK_CHECK(vkFlushMappedMemoryRanges(C.device, 1, &r));
+}
+
+void invalidate_arena(const VulkanCtx& C, const MemArena& a) {
+    if (!a.map || (a.flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) return;
+    VkMappedMemoryRange r{VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE}; r.memory = a.mem; r.offset = 0; r.size = VK_WHOLE_SIZE;
+    VK_CHECK(vkInvalidateMappedMemoryRanges(C.device, 1, &r));
+}
+
+// Host -> buffer, through the mapping or the staging buffer
+void gpu_write(VulkanCtx& C, const MemArena& a, const GpuBuf& b, const void* src, size_t bytes) {
+    if (!bytes) return;
+    if (b.map) { std::memcpy(b.map, src, bytes); flush_arena(C, a); return; }
+    ensure_staging(C, bytes);
+    std::memcpy(C.staging.map, src, bytes);
+    submit_once(C, [&](VkCommandBuffer cb){
+        VkBufferCopy cp{0, 0, bytes};
+        vkCmdCopyBuffer(cb, C.staging.buf, b.buf, 1, &cp);
+    });
+}
+
+// Buffer -> host
+void gpu_read(VulkanCtx& C, const MemArena& a, const GpuBuf& b, void* dst, size_t bytes) {
+    if (!bytes) return;
+    if (b.map) { invalidate_arena(C, a); std::memcpy(dst, b.map, bytes); return; }
+    ensure_staging(C, bytes);
+    submit_once(C, [&](VkCommandBuffer cb){
+        VkBufferCopy cp{0, 0, bytes};
+        vkCmdCopyBuffer(cb, b.buf, C.staging.buf, 1, &cp);
+    });
+    std::memcpy(dst, C.staging.map, bytes);
+}
+
+void gpu_fill(VulkanCtx& C, const MemArena& a, const GpuBuf& b, uint32_t word, size_t bytes) {
+    if (!bytes) return;
+    if (b.map) { std::fill_n((uint32_t*)b.map, bytes / 4, word); flush_arena(C, a); return; }
+    submit_once(C, [&](VkCommandBuffer cb){ vkCmdFillBuffer(cb, b.buf, 0, bytes, word); });
+}
+
+
+static bool contains_str(const char* s, const char* needle){
+    return s && needle && std::strstr(s, needle);
+}
+
+VkResult try_init_vulkan(VulkanCtx& C) {
+    auto fail = [&](VkResult r){ destroy_vulkan(C); return r; };
+    // Instance
+    VkApplicationInfo ai{VK_STRUCTURE_TYPE_APPLICATION_INFO};
+    ai.pApplicationName = "vk-autotune";
+    ai.apiVersion = VK_API_VERSION_1_3;
+
+    VkInstanceCreateInfo ici{VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO};
+    ici.pApplicationInfo = &ai;
+    if (VkResult r = vkCreateInstance(&ici, nullptr, &C.instance)) return fail(r);
+
+    // Pick compute queue physical device (avoid software stacks)
+    uint32_t ndev=0;
+    if (VkResult r = vkEnumeratePhysicalDevices(C.instance, &ndev, nullptr)) return fail(r);
+    std::vector<VkPhysicalDevice> devs(ndev);
+    if (VkResult r = vkEnumeratePhysicalDevices(C.instance, &ndev, devs.data())) return fail(r);
+    if (devs.empty()) return fail(VK_ERROR_INITIALIZATION_FAILED);
+
+    for (auto d : devs) {
+        VkPhysicalDeviceProperties p{}; vkGetPhysicalDeviceProperties(d, &p);
+        uint32_t qf=0; vkGetPhysicalDeviceQueueFamilyProperties(d, &qf, nullptr);
+        std::vector<VkQueueFamilyProperties> qfp(qf); vkGetPhysicalDeviceQueueFamilyProperties(d, &qf, qfp.data());
+        int computeFam = -1;
+        for (uint32_t i=0;i<qf;i++) if (qfp[i].queueFlags & VK_QUEUE_COMPUTE_BIT) { computeFam = (int)i; break; }
+        if (computeFam<0) continue;
+        if (contains_str(p.deviceName, "llvmpipe") || contains_str(p.deviceName, "lavapipe") || contains_str(p.deviceName, "software")) continue;
+        C.pdev = d; C.qfam = (uint32_t)computeFam; C.props = p; break;
+    }
+    if (!C.pdev) { // fallback
+        C.pdev = devs[0];
+        vkGetPhysicalDeviceProperties(C.pdev, &C.props);
+        uint32_t qf=0; vkGetPhysicalDeviceQueueFamilyProperties(C.pdev, &qf, nullptr);
+        std::vector<VkQueueFamilyProperties> qfp(qf); vkGetPhysicalDeviceQueueFamilyProperties(C.pdev, &qf, qfp.data());
+        for (uint32_t i=0;i<qf;i++) if (qfp[i].queueFlags & VK_QUEUE_COMPUTE_BIT) { C.qfam = i; break; }
+    }
+
+    // Subgroup + ID props (device UUID keys the tuning DB)
+    VkPhysicalDeviceIDProperties idprops{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES };
+    C.subprops = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES };
+    C.subprops.pNext = &idprops;
+    VkPhysicalDeviceProperties2 p2{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+    p2.pNext = &C.subprops;
+    vkGetPhysicalDeviceProperties2(C.pdev, &p2);
+    C.subprops.pNext = nullptr;
+    std::memcpy(C.device_uuid, idprops.deviceUUID, VK_UUID_SIZE);
+    vkGetPhysicalDeviceMemoryProperties(C.pdev, &C.memprops);
+
+    // Compiler statistics per pipeline (registers, spills, instructions), optional
+    uint32_t next = 0;
+    if (VkResult r = vkEnumerateDeviceExtensionProperties(C.pdev, nullptr, &next, nullptr)) return fail(r);
+    std::vector<VkExtensionProperties> exts(next);
+    if (VkResult r = vkEnumerateDeviceExtensionProperties(C.pdev, nullptr, &next, exts.data())) return fail(r);
+    VkPhysicalDevicePipelineExecutablePropertiesFeaturesKHR pexf{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PIPELINE_EXECUTABLE_PROPERTIES_FEATURES_KHR };
+    for (const auto& e : exts) {
+        if (strcmp(e.extensionName, VK_KHR_PIPELINE_EXECUTABLE_PROPERTIES_EXTENSION_NAME)) continue;
+        VkPhysicalDeviceFeatures2 f2{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+        f2.pNext = &pexf;
+        vkGetPhysicalDeviceFeatures2(C.pdev, &f2);
+        C.exec_stats = pexf.pipelineExecutableInfo == VK_TRUE;
+    }
+    // Timeline semaphores (core in 1.2) for the multi-stream mode, optional
+    VkPhysicalDeviceTimelineSemaphoreFeatures tsf{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES };
+    if (C.props.apiVersion >= VK_API_VERSION_1_2) {
+        VkPhysicalDeviceFeatures2 f2{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+        f2.pNext = &tsf;
+        vkGetPhysicalDeviceFeatures2(C.pdev, &f2);
+        C.timeline = tsf.timelineSemaphore == VK_TRUE;
+    }
+
+    // Device, with every queue of the compute family (up to kMaxQueues)
+    uint32_t nqf = 0; vkGetPhysicalDeviceQueueFamilyProperties(C.pdev, &nqf, nullptr);
+    std::vector<VkQueueFamilyProperties> qfp(nqf); vkGetPhysicalDeviceQueueFamilyProperties(C.pdev, &nqf, qfp.data());
+    const uint32_t nq = std::max(1u, std::min(qfp[C.qfam].queueCount, kMaxQueues));
+    std::vector<float> prio(nq, 1.0f);
+    VkDeviceQueueCreateInfo qci{VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO};
+    qci.queueFamilyIndex = C.qfam;
+    qci.queueCount = nq; qci.pQueuePriorities = prio.data();
+    VkDeviceCreateInfo dci{VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO};
+    dci.queueCreateInfoCount = 1; dci.pQueueCreateInfos = &qci;
+    const char* ext_names[] = { VK_KHR_PIPELINE_EXECUTABLE_PROPERTIES_EXTENSION_NAME };
+    tsf.pNext = nullptr;
+    if (C.timeline) dci.pNext = &tsf;
+    if (C.exec_stats) {
+        pexf.pNext = C.timeline ? &tsf : nullptr;
+        dci.pNext = &pexf;
+        dci.enabledExtensionCount = 1; dci.ppEnabledExtensionNames = ext_names;
+    }
+    if (VkResult r = vkCreateDevice(C.pdev, &dci, nullptr, &C.device)) return fail(r);
+    C.queues.resize(nq);
+    for (uint32_t i=0; i<nq; i++) vkGetDeviceQueue(C.device, C.qfam, i, &C.queues[i]);
+    C.queue = C.queues[0];
+    if (C.exec_stats) {
+        C.get_exec_props = (PFN_vkGetPipelineExecutablePropertiesKHR)vkGetDeviceProcAddr(C.device, "vkGetPipelineExecutablePropertiesKHR");
+        C.get_exec_stats = (PFN_vkGetPipelineExecutableStatisticsKHR)vkGetDeviceProcAddr(C.device, "vkGetPipelineExecutableStatisticsKHR");
+        C.exec_stats = C.get_exec_props && C.get_exec_stats;
+    }
+
+    // Command pool
+    VkCommandPoolCreateInfo pci{VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+    pci.queueFamilyIndex = C.qfam;
+    if (VkResult r = vkCreateCommandPool(C.device, &pci, nullptr, &C.cpool)) return fail(r);
+
+    // Descriptor set layout (A,B,C,bias)
+    VkDescriptorSetLayoutBinding b[4] = {};
+    for (int i=0;i<4;i++){ b[i].binding = i; b[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; b[i].descriptorCount=1; b[i].stageFlags=VK_SHADER_STAGE_COMPUTE_BIT; }
+    VkDescriptorSetLayoutCreateInfo dlci{VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
+    dlci.bindingCount = 4; dlci.pBindings = b;
+    if (VkResult r = vkCreateDescriptorSetLayout(C.device, &dlci, nullptr, &C.dsl)) return fail(r);
+
+    // Pipeline layout (push constants {M,N,K,lda,ldb,ldc,KS,S,sA,sB,sC,SS,alpha,beta})
+    VkPushConstantRange pcr{}; pcr.offset=0; pcr.size=14*sizeof(uint32_t); pcr.stageFlags=VK_SHADER_STAGE_COMPUTE_BIT;
+    VkPipelineLayoutCreateInfo plci{VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    plci.setLayoutCount = 1; plci.pSetLayouts = &C.dsl;
+    plci.pushConstantRangeCount = 1; plci.pPushConstantRanges = &pcr;
+    if (VkResult r = vkCreatePipelineLayout(C.device, &plci, nullptr, &C.ppl)) return fail(r);
+
+    // Descriptor pool: the GEMM path's sets (see GemmSets) and the bandwidth kernel's
+    VkDescriptorPoolSize dps{}; dps.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; dps.descriptorCount = 10*4;
+    VkDescriptorPoolCreateInfo dpci{VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+    dpci.maxSets = 10; dpci.poolSizeCount = 1; dpci.pPoolSizes = &dps;
+    if (VkResult r = vkCreateDescriptorPool(C.device, &dpci, nullptr, &C.dpool)) return fail(r);
+
+    C.timestamp_period_ns = C.props.limits.timestampPeriod ? C.props.limits.timestampPeriod : 1.0;
+
+    // Banner
+    fprintf(stderr,
+        "# Device: %s (API %u.%u)  driver=%u\n"
+        "# maxWGInvocations=%u, maxSharedMemPerWG=%u bytes, subgroupSize=%u\n"
+        "# shader-compiler=%s  pipeline-stats=%s  compute queues=%zu  timeline semaphores=%s\n",
+        C.props.deviceName,
+        VK_VERSION_MAJOR(C.props.apiVersion), VK_VERSION_MINOR(C.props.apiVersion),
+        C.props.driverVersion,
+        C.props.limits.maxComputeWorkGroupInvocations,
+        C.props.limits.maxComputeSharedMemorySize,
+        C.subprops.subgroupSize,
+        VK_AT_COMPILE_TOOL, C.exec_stats ? "yes" : "no", C.queues.size(), C.timeline ? "yes" : "no"
+    );
+    return VK_SUCCESS;
+}
+
+void init_vulkan(VulkanCtx& C) {
+    VK_CHECK(try_init_vulkan(C));
+}
+
+
+void destroy_vulkan(VulkanCtx& C) {
+    if (C.device) {
+        destroy_arena(C, C.staging_arena, {&C.staging});
+        vkDestroyDescriptorPool(C.device, C.dpool, nullptr);
+        vkDestroyPipelineLayout(C.device, C.ppl, nullptr);
+        vkDestroyDescriptorSetLayout(C.device, C.dsl, nullptr);
+        vkDestroyCommandPool(C.device, C.cpool, nullptr);
+        vkDestroyDevice(C.device, nullptr);
+    }
+    if (C.instance) vkDestroyInstance(C.instance, nullptr);
+    C = VulkanCtx{};
+}
+
+VkShaderModule make_shader(VkDevice dev, const std::vector<uint32_t>& spv){
+    VkShaderModuleCreateInfo ci{VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO};
+    ci.codeSize = spv.size()*sizeof(uint32_t);
+    ci.pCode = spv.data();
+    VkShaderModule mod;
+    VK_CHECK(vkCreateShaderModule(dev, &ci, nullptr, &mod));
+    return mod;
+}
+
+
+
+std::string pipeline_stats(const VulkanCtx& C, VkPipeline pipe) {
+    if (!C.exec_stats || !pipe) return "";
+    VkPipelineInfoKHR pi{ VK_STRUCTURE_TYPE_PIPELINE_INFO_KHR };
+    pi.pipeline = pipe;
+    uint32_t nexe = 0;
+    if (C.get_exec_props(C.device, &pi, &nexe, nullptr) != VK_SUCCESS) return "";
+    std::string out;
+    for (uint32_t e=0; e<nexe; e++) {
+        VkPipelineExecutableInfoKHR ei{ VK_STRUCTURE_TYPE_PIPELINE_EXECUTABLE_INFO_KHR };
+        ei.pipeline = pipe; ei.executableIndex = e;
+        uint32_t ns = 0;
+        if (C.get_exec_stats(C.device, &ei, &ns, nullptr) != VK_SUCCESS) continue;
+        std::vector<VkPipelineExecutableStatisticKHR> st(ns, { VK_STRUCTURE_TYPE_PIPELINE_EXECUTABLE_STATISTIC_KHR });
+        if (C.get_exec_stats(C.device, &ei, &ns, st.data()) != VK_SUCCESS) continue;
+        for (const auto& s : st) {
+            std::string name;
+            for (const char* p = s.name; *p; ++p) name += isalnum((unsigned char)*p) ? (char)tolower((unsigned char)*p) : '_';
+            char val[32];
+            switch (s.format) {
+            case VK_PIPELINE_EXECUTABLE_STATISTIC_FORMAT_BOOL32_KHR:  snprintf(val, sizeof(val), "%u", s.value.b32); break;
+            case VK_PIPELINE_EXECUTABLE_STATISTIC_FORMAT_INT64_KHR:   snprintf(val, sizeof(val), "%lld", (long long)s.value.i64); break;
+            case VK_PIPELINE_EXECUTABLE_STATISTIC_FORMAT_UINT64_KHR:  snprintf(val, sizeof(val), "%llu", (unsigned long long)s.value.u64); break;
+            default:                                                  snprintf(val, sizeof(val), "%g", s.value.f64); break;
+            }
+            if (!out.empty()) out += ';';
+            if (nexe > 1) out += std::to_string(e) + ".";
+            out += name + "=" + val;
+        }
+    }
+    return out;
+}
+
+// On-disk VkPipelineCache. The blob starts with VkPipelineCacheHeaderVersionOne
+// (length, version, vendorID, deviceID, pipelineCacheUUID); anything written by
+// another device or driver build is dropped rather than handed to the driver.
+VkPipelineCache load_pipeline_cache(const VulkanCtx& C, const std::string& path) {
+    std::vector<char> blob;
+    if (!path.empty()) {
+        std::ifstream f(path, std::ios::binary);
+        if (f) blob.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+    }
+    if (blob.size() >= 16 + VK_UUID_SIZE) {
+        uint32_t hdr[4]; std::memcpy(hdr, blob.data(), sizeof(hdr));
+        bool ok = hdr[0] >= 16 + VK_UUID_SIZE && hdr[1] == 1u /*VK_PIPELINE_CACHE_HEADER_VERSION_ONE*/ &&
+                  hdr[2] == C.props.vendorID && hdr[3] == C.props.deviceID &&
+                  !std::memcmp(blob.data() + 16, C.props.pipelineCacheUUID, VK_UUID_SIZE);
+        if (!ok) { fprintf(stderr, "# pipeline-cache %s is from another device/driver; starting empty\n", path.c_str()); blob.clear(); }
+    } else {
+        blob.clear();
+    }
+    VkPipelineCacheCreateInfo ci{VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO};
+    ci.initialDataSize = blob.size(); ci.pInitialData = blob.empty() ? nullptr : blob.data();
+    VkPipelineCache cache = VK_NULL_HANDLE;
+    if (VkResult r = vkCreatePipelineCache(C.device, &ci, nullptr, &cache)) {
+        fprintf(stderr, "# pipeline-cache: vkCreatePipelineCache failed (VkResult %d), compiling without one\n", r);
+        return VK_NULL_HANDLE;
+    }
+    if (!path.empty()) fprintf(stderr, "# pipeline-cache=%s  loaded=%zuB\n", path.c_str(), blob.size());
+    return cache;
+}
+
+void save_pipeline_cache(const VulkanCtx& C, VkPipelineCache cache, const std::string& path) {
+    if (path.empty() || !cache) return;
+    size_t n = 0;
+    if (vkGetPipelineCacheData(C.device, cache, &n, nullptr) != VK_SUCCESS || !n) return;
+    std::vector<char> blob(n);
+    if (vkGetPipelineCacheData(C.device, cache, &n, blob.data()) != VK_SUCCESS) return;
+    // write-then-rename so an interrupted save never leaves a truncated cache
+    std::string tmp = path + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (!f) { perror("fopen pipeline cache"); return; }
+    bool ok = fwrite(blob.data(), 1, n, f) == n;
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) { perror("write pipeline cache"); remove(tmp.c_str()); }
+}
+
@@ -0,0 +1,161 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 davidscarth
+ */
+#pragma once
+
+// Vulkan plumbing shared by the autotune executable and the vkgemm runtime
+// (vk_gemm.h): device/context setup, arena-allocated buffers, shader modules,
+// the on-disk pipeline cache.
+//
+// Functions that return a VkResult (try_*, create_pipeline, ...) report
+// errors. The rest are the tuner's helpers and exit the process on an error:
+// VK_CHECK, load_spirv, init_vulkan, create_arena, pick_memory_type,
+// submit_once, gpu_write/gpu_read/gpu_fill, make_shader.
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#define VK_CHECK(x) do { VkResult err = (x); if (err) { fprintf(stderr,"Vulkan error %d at %s:%d\n", err, __FILE__, __LINE__); std::exit(1);} } while(0)
+
+
+std::vector<uint32_t> load_spirv(const char* path);
+
+inline uint32_t ceil_div(uint32_t a, uint32_t b){ return (a + b - 1u)/b; }
+
+// Dispatches per command buffer; the query pool holds a timestamp pair for each
+constexpr uint32_t kMaxChunk = 128;
+// Queues created from the compute family (--streams spreads over them)
+constexpr uint32_t kMaxQueues = 8;
+
+
+// ---------------------------------------------------------------------------
+// Memory placement (--mem=)
+// ---------------------------------------------------------------------------
+//   coherent  HOST_VISIBLE|HOST_COHERENT, written and read through a mapping
+//   cached    HOST_VISIBLE|HOST_CACHED, mapped, with explicit flush/invalidate
+//   device    DEVICE_LOCAL (a non-host-visible type if there is one), filled and
+//             read back through a host-coherent staging buffer
+enum class MemPlace { Coherent, Cached, Device };
+
+inline const char* mem_place_name(MemPlace p) {
+    return p == MemPlace::Device ? "device" : p == MemPlace::Cached ? "cached" : "coherent";
+}
+
+// A buffer suballocated from a MemArena
+struct GpuBuf {
+    VkBuffer buf = VK_NULL_HANDLE;
+    VkDeviceSize size = 0, offset = 0;
+    uint8_t* map = nullptr;     // null unless the arena is host-visible
+};
+
+// One VkDeviceMemory block per memory type; buffers are bound at aligned offsets
+struct MemArena {
+    VkDeviceMemory mem = VK_NULL_HANDLE;
+    uint32_t type = UINT32_MAX;
+    VkMemoryPropertyFlags flags = 0;
+    VkDeviceSize size = 0;
+    uint8_t* map = nullptr;
+};
+
+struct VulkanCtx {
+    VkInstance instance = VK_NULL_HANDLE;
+    VkPhysicalDevice pdev = VK_NULL_HANDLE;
+    VkDevice device = VK_NULL_HANDLE;
+    uint32_t qfam = 0;
+    VkQueue queue = VK_NULL_HANDLE;     // queues[0], used for everything but --streams
+    std::vector<VkQueue> queues;        // every queue of qfam, at most kMaxQueues
+    bool timeline = false;              // timelineSemaphore feature enabled
+    VkPhysicalDeviceProperties props{};
+    VkPhysicalDeviceSubgroupProperties subprops{};
+    VkPhysicalDeviceMemoryProperties memprops{};
+    uint8_t device_uuid[VK_UUID_SIZE] = {};
+    VkCommandPool cpool = VK_NULL_HANDLE;   // submit_once's; TunedGemm uses its own
+    VkDescriptorSetLayout dsl = VK_NULL_HANDLE;
+    VkPipelineLayout ppl = VK_NULL_HANDLE;
+    VkDescriptorPool dpool = VK_NULL_HANDLE;
+    MemArena staging_arena;             // --mem=device uploads/readback
+    GpuBuf staging;
+    double timestamp_period_ns = 1.0;
+    // VK_KHR_pipeline_executable_properties, when the driver has it
+    bool exec_stats = false;
+    PFN_vkGetPipelineExecutablePropertiesKHR get_exec_props = nullptr;
+    PFN_vkGetPipelineExecutableStatisticsKHR get_exec_stats = nullptr;
+};
+
+
+// "index:DL|HV|HC|HCa" of the arena's memory type
+std::string mem_type_desc(const MemArena& a);
+// First type in `bits` with all of `want`, preferring ones without any of `avoid`
+uint32_t find_memory_type(const VulkanCtx& C, uint32_t bits, VkMemoryPropertyFlags want, VkMemoryPropertyFlags avoid);
+uint32_t pick_memory_type(const VulkanCtx& C, uint32_t bits, MemPlace p);
+// Create every buffer in `bufs` (sizes preset) and bind them all to one allocation
+MemArena create_arena(const VulkanCtx& C, MemPlace p, const std::vector<GpuBuf*>& bufs);
+// create_arena for library callers: returns the error instead of exiting
+// (VK_ERROR_FEATURE_NOT_PRESENT = no usable memory type) and leaves nothing allocated
+VkResult try_create_arena(const VulkanCtx& C, MemPlace p, const std::vector<GpuBuf*>& bufs, MemArena* out);
+void destroy_arena(const VulkanCtx& C, MemArena& a, const std::vector<GpuBuf*>& bufs);
+
+// Record with `rec`, submit, and wait; barriers order it against earlier and later dispatches
+template <class F>
+void submit_once(VulkanCtx& C, F rec) {
+    VkCommandBufferAllocateInfo cbai{VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+    cbai.commandPool = C.cpool; cbai.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY; cbai.commandBufferCount = 1;
+    VkCommandBuffer cb; VK_CHECK(vkAllocateCommandBuffers(C.device, &cbai, &cb));
+    VkCommandBufferBeginInfo cbi{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    cbi.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VK_CHECK(vkBeginCommandBuffer(cb, &cbi));
+    VkMemoryBarrier mb{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    mb.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    mb.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0, 1, &mb, 0, nullptr, 0, nullptr);
+    rec(cb);
+    mb.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    mb.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+                         0, 1, &mb, 0, nullptr, 0, nullptr);
+    VK_CHECK(vkEndCommandBuffer(cb));
+    VkFenceCreateInfo fci{VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+    VkFence fence; VK_CHECK(vkCreateFence(C.device, &fci, nullptr, &fence));
+    VkSubmitInfo si{VK_STRUCTURE_TYPE_SUBMIT_INFO};
+    si.commandBufferCount = 1; si.pCommandBuffers = &cb;
+    VK_CHECK(vkQueueSubmit(C.queue, 1, &si, fence));
+    VK_CHECK(vkWaitForFences(C.device, 1, &fence, VK_TRUE, UINT64_MAX));
+    vkDestroyFence(C.device, fence, nullptr);
+    vkFreeCommandBuffers(C.device, C.cpool, 1, &cb);
+}
+
+// Host <-> buffer, through the mapping or the (grown on demand) staging buffer
+void ensure_staging(VulkanCtx& C, VkDeviceSize bytes);
+void flush_arena(const VulkanCtx& C, const MemArena& a);
+void invalidate_arena(const VulkanCtx& C, const MemArena& a);
+void gpu_write(VulkanCtx& C, const MemArena& a, const GpuBuf& b, const void* src, size_t bytes);
+void gpu_read(VulkanCtx& C, const MemArena& a, const GpuBuf& b, void* dst, size_t bytes);
+// Fill the first `bytes` (a multiple of 4) with a repeated 32-bit word
+void gpu_fill(VulkanCtx& C, const MemArena& a, const GpuBuf& b, uint32_t word, size_t bytes);
+
+// First non-software compute device, every queue of its compute family, a
+// command pool, the GEMM set/pipeline layouts and a descriptor pool; prints a
+// banner to stderr. On an error everything created so far is destroyed again
+// (VK_ERROR_INITIALIZATION_FAILED = no device).
+VkResult try_init_vulkan(VulkanCtx& C);
+void init_vulkan(VulkanCtx& C);
+// Everything init_vulkan created plus the staging buffer; arenas and pipelines
+// of the caller must be gone already
+void destroy_vulkan(VulkanCtx& C);
+
+VkShaderModule make_shader(VkDevice dev, const std::vector<uint32_t>& spv);
+
+// Driver compiler statistics of a pipeline as "name=value;..." (names are the
+// driver's, lowercased with '_' for other characters, e.g. Mesa V3D reports
+// instruction_count, threads, spills, fills). Empty without the extension.
+std::string pipeline_stats(const VulkanCtx& C, VkPipeline pipe);
+
+// On-disk VkPipelineCache; "" = in memory only. A blob written by another
+// device or driver build is dropped, saving writes a temp file and renames it.
+VkPipelineCache load_pipeline_cache(const VulkanCtx& C, const std::string& path);
+void save_pipeline_cache(const VulkanCtx& C, VkPipelineCache cache, const std::string& path);
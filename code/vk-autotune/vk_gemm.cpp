@@ -0,0 +1,441 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 davidscarth
+ */
+
+#include "vk_gemm.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <unordered_map>
+
+bool parse_epilogue(const char* s, uint32_t* epi) {
+    uint32_t e = 0;
+    std::string t(s);
+    size_t pos = 0;
+    while (pos <= t.size()) {
+        size_t end = t.find('+', pos); if (end == std::string::npos) end = t.size();
+        std::string w = t.substr(pos, end - pos); pos = end + 1;
+        if (w.empty() || w == "none") continue;
+        if (w == "scale") e |= EPI_SCALE;
+        else if (w == "bias") e |= EPI_BIAS;
+        else if ((w == "relu" || w == "silu" || w == "gelu") && !(e & EPI_ACT_MASK))
+            e |= w == "relu" ? EPI_RELU : w == "silu" ? EPI_SILU : EPI_GELU;
+        else return false;
+    }
+    *epi = e;
+    return true;
+}
+
+std::string epilogue_name(uint32_t e) {
+    static const char* act[4] = {"", "relu", "silu", "gelu"};
+    std::string s;
+    auto add = [&](const char* w){ if (!s.empty()) s += '+'; s += w; };
+    if (e & EPI_SCALE) add("scale");
+    if (e & EPI_BIAS) add("bias");
+    if (e & EPI_ACT_MASK) add(act[e & EPI_ACT_MASK]);
+    return s.empty() ? "none" : s;
+}
+
+uint32_t smem_bytes(const Cand& g) {
+    if (g.fam == 0) return 4u * g.TK * (g.TM + g.TN);
+    return 4u * (g.dbuf ? 2u : 1u) * (g.TM * (g.TK + g.pad) + g.TK * (g.TN + g.pad));
+}
+
+VkResult create_pipeline(const VulkanCtx& C, const VkShaderModule* mods, VkPipelineCache cache,
+                         const Cand& g, VkPipeline* pipe) {
+    uint32_t SH_ELEMS = g.fam ? smem_bytes(g) / 4u : g.TM*g.TK + g.TK*g.TN;
+    uint32_t RN = (g.TN + g.lszx - 1) / g.lszx, RM = (g.TM + g.lszy - 1) / g.lszy;
+    const uint32_t epi = g.fused ? g.epi : 0u;
+    uint32_t spec[16] = { g.lszx, g.lszy, g.TM, g.TN, g.TK, g.fam ? g.vec : g.smem, SH_ELEMS, g.dbuf, g.pad, RM, RN };
+    uint32_t n = g.fam ? 11u : 7u;
+    VkSpecializationMapEntry me[16];
+    for (uint32_t i=0;i<n;i++){ me[i].constantID=i; me[i].offset=i*sizeof(uint32_t); me[i].size=sizeof(uint32_t); }
+    spec[n] = g.packb; me[n].constantID=11; me[n].offset=n*sizeof(uint32_t); me[n].size=sizeof(uint32_t); n++;
+    const uint32_t epi_spec[3] = { epi & EPI_ACT_MASK, (epi & EPI_BIAS) ? 1u : 0u, (epi & EPI_SCALE) ? 1u : 0u };
+    for (uint32_t j=0;j<3;j++,n++){ spec[n] = epi_spec[j]; me[n].constantID=16+j; me[n].offset=n*sizeof(uint32_t); me[n].size=sizeof(uint32_t); }
+    VkSpecializationInfo si{}; si.mapEntryCount=n; si.pMapEntries=me; si.dataSize=n*sizeof(uint32_t); si.pData=spec;
+
+    VkPipelineShaderStageCreateInfo ss{VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO};
+    ss.stage = VK_SHADER_STAGE_COMPUTE_BIT; ss.module = mods[g.fam]; ss.pName = "main"; ss.pSpecializationInfo = &si;
+
+    VkComputePipelineCreateInfo pci{VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+    pci.stage = ss; pci.layout = C.ppl;
+    if (C.exec_stats) pci.flags = VK_PIPELINE_CREATE_CAPTURE_STATISTICS_BIT_KHR;
+    *pipe = VK_NULL_HANDLE;
+    return vkCreateComputePipelines(C.device, cache, 1, &pci, nullptr, pipe);
+}
+
+VkResult create_reduce_pipeline(const VulkanCtx& C, VkShaderModule mod, VkPipelineCache cache,
+                                uint32_t epi, VkPipeline* pipe) {
+    const uint32_t spec[3] = { epi & EPI_ACT_MASK, (epi & EPI_BIAS) ? 1u : 0u, (epi & EPI_SCALE) ? 1u : 0u };
+    VkSpecializationMapEntry me[3];
+    for (uint32_t j=0;j<3;j++){ me[j].constantID=16+j; me[j].offset=j*sizeof(uint32_t); me[j].size=sizeof(uint32_t); }
+    VkSpecializationInfo si{}; si.mapEntryCount=3; si.pMapEntries=me; si.dataSize=sizeof(spec); si.pData=spec;
+    VkComputePipelineCreateInfo pci{VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+    pci.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pci.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT; pci.stage.module = mod; pci.stage.pName = "main";
+    pci.stage.pSpecializationInfo = &si;
+    pci.layout = C.ppl;
+    *pipe = VK_NULL_HANDLE;
+    return vkCreateComputePipelines(C.device, cache, 1, &pci, nullptr, pipe);
+}
+
+uint32_t splitk_chunk(const Cand& g, uint32_t K) {
+    return std::max(g.TK, ceil_div(ceil_div(K, g.splitk), g.TK) * g.TK);
+}
+
+uint32_t splitk_slices(const Cand& g, uint32_t K) {
+    return g.splitk > 1 ? std::max(1u, ceil_div(K, splitk_chunk(g, K))) : 1u;
+}
+
+size_t packed_b_floats(uint32_t K, uint32_t N, uint32_t TK, uint32_t TN) {
+    return size_t(ceil_div(N, TN)) * ceil_div(K, TK) * TK * TN;
+}
+
+void pack_b(const float* B, uint32_t K, uint32_t N, uint32_t ldb, uint32_t TK, uint32_t TN, float* out) {
+    const uint32_t nk = ceil_div(K, TK);
+    for (uint32_t j=0; j<ceil_div(N, TN); j++) {
+        const uint32_t n0 = j * TN, w = std::min(TN, N - n0);
+        for (uint32_t kb=0; kb<nk; kb++) {
+            float* blk = out + (size_t(j) * nk + kb) * TK * TN;
+            for (uint32_t r=0; r<TK; r++) {
+                const uint32_t k = kb * TK + r;
+                float* dst = blk + size_t(r) * TN;
+                if (k < K) std::memcpy(dst, B + size_t(k) * ldb + n0, w * sizeof(float));
+                std::fill(dst + (k < K ? w : 0), dst + TN, 0.0f);
+            }
+        }
+    }
+}
+
+std::vector<uint32_t> gemm_push(const Cand& g, uint32_t M, uint32_t N, uint32_t K, uint32_t batch,
+                                float alpha, float beta) {
+    const uint32_t sA = M * K, sC = M * N;
+    const uint32_t sB = g.packb ? uint32_t(packed_b_floats(K, N, g.TK, g.TN)) : K * N;
+    std::vector<uint32_t> push = { M, N, K, K, N, N, K, 1, sA, sB, sC, 0, fbits(alpha), fbits(beta) };
+    if (splitk_slices(g, K) > 1) {
+        push[6] = splitk_chunk(g, K); push[7] = splitk_slices(g, K); push[11] = sC * batch;
+    }
+    return push;
+}
+
+// ---------------------------------------------------------------------------
+// TunedGemm
+// ---------------------------------------------------------------------------
+TunedGemm::TunedGemm(VulkanCtx& C, const std::string& shader_dir, const std::string& cache_path)
+    : C_(C), dir_(shader_dir), cache_path_(cache_path) {
+    cache_ = load_pipeline_cache(C_, cache_path_);
+}
+
+TunedGemm::~TunedGemm() {
+    save_pipeline_cache(C_, cache_, cache_path_);
+    for (auto& [g, p] : pipes_) vkDestroyPipeline(C_.device, p, nullptr);
+    for (auto& [epi, p] : reduce_) if (p) vkDestroyPipeline(C_.device, p, nullptr);
+    for (VkShaderModule m : mods_) if (m) vkDestroyShaderModule(C_.device, m, nullptr);
+    if (reduce_mod_) vkDestroyShaderModule(C_.device, reduce_mod_, nullptr);
+    for (const Pool& p : pools_) vkDestroyDescriptorPool(C_.device, p.pool, nullptr);
+    if (cpool_) vkDestroyCommandPool(C_.device, cpool_, nullptr);
+    for (size_t i=0; i<ws_.size(); i++) destroy_arena(C_, ws_arenas_[i], {&ws_[i]});
+    vkDestroyPipelineCache(C_.device, cache_, nullptr);
+}
+
+size_t TunedGemm::load(const std::string& path) {
+    std::ifstream f(path);
+    if (!f) { fprintf(stderr, "vkgemm: cannot open %s\n", path.c_str()); return 0; }
+    auto split_tab = [](const std::string& line){
+        std::vector<std::string> v; std::stringstream ss(line); std::string item;
+        while (std::getline(ss, item, '\t')) v.push_back(item);
+        return v;
+    };
+    std::string line;
+    std::unordered_map<std::string, size_t> col;
+    if (std::getline(f, line)) {
+        auto names = split_tab(line);
+        for (size_t i=0; i<names.size(); i++) col[names[i]] = i;
+    }
+    for (const char* req : {"M", "N", "K", "TM", "TN", "TK", "lszx", "lszy", "smem"})
+        if (!col.count(req)) { fprintf(stderr, "vkgemm: %s is not a winner table (no %s column)\n", path.c_str(), req); return 0; }
+
+    size_t n = 0;
+    while (std::getline(f, line)) {
+        if (line.empty()) continue;
+        const auto v = split_tab(line);
+        auto str = [&](const char* name) -> std::string {
+            auto it = col.find(name);
+            return it == col.end() || it->second >= v.size() ? std::string() : v[it->second];
+        };
+        auto num = [&](const char* name, uint32_t def) -> uint32_t {
+            std::string s = str(name);
+            return s.empty() ? def : (uint32_t)strtoul(s.c_str(), nullptr, 10);
+        };
+        Cand g{ num("TM", 0), num("TN", 0), num("TK", 0), num("lszx", 0), num("lszy", 0), num("smem", 1) };
+        g.fam = str("family") == "v2" ? 1u : 0u;
+        g.vec = num("vec", 1); g.dbuf = num("dbuf", 0); g.pad = num("pad", 0);
+        g.splitk = std::max(1u, num("splitk", 1));
+        g.packb = num("packb", 0) ? 1u : 0u;
+        std::string epi = str("epilogue");
+        epi = epi.substr(0, epi.find(':'));
+        if (!parse_epilogue(epi.c_str(), &g.epi)) { fprintf(stderr, "vkgemm: %s: bad epilogue '%s'\n", path.c_str(), epi.c_str()); continue; }
+        const uint32_t M = num("M", 0), N = num("N", 0), K = num("K", 0);
+        if (!M || !N || !K || !g.TM || !g.TN || !g.TK || !g.lszx || !g.lszy) continue;
+        add(M, N, K, std::max(1u, num("batch", 1)), g);
+        n++;
+    }
+    return n;
+}
+
+void TunedGemm::add(uint32_t M, uint32_t N, uint32_t K, uint32_t batch, const Cand& g) {
+    Entry e{M, N, K, batch, g};
+    e.g.cpu = 0; e.g.fused = 1;
+    for (Entry& o : table_)
+        if (o.M == M && o.N == N && o.K == K && o.batch == batch) { o = e; return; }
+    table_.push_back(e);
+}
+
+size_t TunedGemm::nearest(uint32_t M, uint32_t N, uint32_t K, uint32_t batch) const {
+    size_t best = table_.size();
+    double best_d = 0.0;
+    auto dist = [](uint32_t a, uint32_t b){ return std::fabs(std::log2(double(a) / double(b))); };
+    for (size_t i=0; i<table_.size(); i++) {
+        const Entry& e = table_[i];
+        double d = dist(M, e.M) + dist(N, e.N) + dist(K, e.K) + dist(batch, e.batch);
+        if (best == table_.size() || d < best_d) { best = i; best_d = d; }
+        if (d == 0.0) break;
+    }
+    return best;
+}
+
+const Cand* TunedGemm::pick(uint32_t M, uint32_t N, uint32_t K, uint32_t batch) const {
+    size_t i = nearest(M, N, K, batch);
+    return i < table_.size() ? &table_[i].g : nullptr;
+}
+
+size_t TunedGemm::packed_b_size(uint32_t M, uint32_t N, uint32_t K, uint32_t batch) const {
+    const Cand* g = pick(M, N, K, batch);
+    return g && g->packb ? packed_b_floats(K, N, g->TK, g->TN) * batch : 0;
+}
+
+bool TunedGemm::pack_b(const float* B, float* out, uint32_t M, uint32_t N, uint32_t K, uint32_t batch) const {
+    const Cand* g = pick(M, N, K, batch);
+    if (!g || !g->packb) return false;
+    const size_t sP = packed_b_floats(K, N, g->TK, g->TN);
+    for (uint32_t b=0; b<batch; b++) ::pack_b(B + size_t(b) * K * N, K, N, N, g->TK, g->TN, out + b * sP);
+    return true;
+}
+
+// A shader module from a .spv file, null with a message instead of exiting
+static VkShaderModule load_module(VkDevice dev, const std::string& path) {
+    std::ifstream f(path, std::ios::binary);
+    if (!f) { fprintf(stderr, "vkgemm: cannot open %s\n", path.c_str()); return VK_NULL_HANDLE; }
+    std::string bytes((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    std::vector<uint32_t> spv((bytes.size() + 3) / 4);
+    std::memcpy(spv.data(), bytes.data(), bytes.size());
+    VkShaderModuleCreateInfo ci{VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO};
+    ci.codeSize = bytes.size(); ci.pCode = spv.data();
+    VkShaderModule mod = VK_NULL_HANDLE;
+    if (VkResult r = vkCreateShaderModule(dev, &ci, nullptr, &mod)) {
+        fprintf(stderr, "vkgemm: shader module %s failed (VkResult %d)\n", path.c_str(), r);
+        return VK_NULL_HANDLE;
+    }
+    return mod;
+}
+
+VkPipeline TunedGemm::pipeline(const Cand& g) {
+    for (const auto& [o, p] : pipes_)
+        if (!std::memcmp(&o, &g, sizeof(Cand))) return p;
+    const uint32_t f = g.fam;
+    if (!mods_[f]) mods_[f] = load_module(C_.device, dir_ + (f ? "/gemm_v2.spv" : "/gemm.spv"));
+    if (!mods_[f]) return VK_NULL_HANDLE;
+    VkPipeline pipe = VK_NULL_HANDLE;
+    VkResult r = create_pipeline(C_, mods_, cache_, g, &pipe);
+    if (r != VK_SUCCESS || !pipe) {
+        fprintf(stderr, "vkgemm: pipeline for tile %ux%ux%u failed (VkResult %d)\n", g.TM, g.TN, g.TK, r);
+        return VK_NULL_HANDLE;
+    }
+    pipes_.emplace_back(g, pipe);
+    return pipe;
+}
+
+VkPipeline TunedGemm::reduce_pipeline(uint32_t epi) {
+    auto it = reduce_.find(epi);
+    if (it != reduce_.end()) return it->second;
+    if (!reduce_mod_) reduce_mod_ = load_module(C_.device, dir_ + "/reduce_epilogue.spv");
+    if (!reduce_mod_) return VK_NULL_HANDLE;
+    VkPipeline pipe = VK_NULL_HANDLE;
+    if (create_reduce_pipeline(C_, reduce_mod_, cache_, epi, &pipe) != VK_SUCCESS) pipe = VK_NULL_HANDLE;
+    return reduce_[epi] = pipe;
+}
+
+VkDescriptorSet TunedGemm::descriptor_set(const std::array<VkDescriptorBufferInfo, 4>& bi) {
+    std::array<uint64_t, 8> key{};
+    for (int i=0; i<4; i++) { std::memcpy(&key[2*i], &bi[i].buffer, sizeof(VkBuffer)); key[2*i+1] = bi[i].offset; }
+    auto it = sets_.find(key);
+    if (it != sets_.end()) return it->second.set;
+    size_t pi = 0;
+    while (pi < pools_.size() && !pools_[pi].left) pi++;
+    if (pi == pools_.size()) {
+        VkDescriptorPoolSize dps{}; dps.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; dps.descriptorCount = kPoolSets*4;
+        VkDescriptorPoolCreateInfo dpci{VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+        dpci.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+        dpci.maxSets = kPoolSets; dpci.poolSizeCount = 1; dpci.pPoolSizes = &dps;
+        VkDescriptorPool pool;
+        if (VkResult r = vkCreateDescriptorPool(C_.device, &dpci, nullptr, &pool)) {
+            fprintf(stderr, "vkgemm: descriptor pool failed (VkResult %d)\n", r);
+            return VK_NULL_HANDLE;
+        }
+        pools_.push_back(Pool{pool, kPoolSets});
+    }
+    VkDescriptorSetAllocateInfo dsai{VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+    dsai.descriptorPool = pools_[pi].pool; dsai.descriptorSetCount = 1; dsai.pSetLayouts = &C_.dsl;
+    VkDescriptorSet dset;
+    if (VkResult r = vkAllocateDescriptorSets(C_.device, &dsai, &dset)) {
+        fprintf(stderr, "vkgemm: descriptor set failed (VkResult %d)\n", r);
+        pools_[pi].left = 0;    // try another pool next time
+        return VK_NULL_HANDLE;
+    }
+    pools_[pi].left--;
+    VkWriteDescriptorSet w[4]{};
+    for (int i=0;i<4;i++){ w[i].sType=VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET; w[i].dstSet=dset; w[i].dstBinding=i; w[i].descriptorCount=1; w[i].descriptorType=VK_DESCRIPTOR_TYPE_STORAGE_BUFFER; w[i].pBufferInfo=&bi[i]; }
+    vkUpdateDescriptorSets(C_.device, 4, w, 0, nullptr);
+    sets_[key] = Set{dset, pi};
+    return dset;
+}
+
+void TunedGemm::forget(VkBuffer buf) {
+    uint64_t h = 0;
+    std::memcpy(&h, &buf, sizeof(VkBuffer));
+    for (auto it = sets_.begin(); it != sets_.end();) {
+        const auto& k = it->first;
+        if (k[0] != h && k[2] != h && k[4] != h && k[6] != h) { ++it; continue; }
+        Pool& p = pools_[it->second.pool];
+        vkFreeDescriptorSets(C_.device, p.pool, 1, &it->second.set);
+        p.left++;
+        it = sets_.erase(it);
+    }
+}
+
+void TunedGemm::reset() {
+    for (Pool& p : pools_) { vkResetDescriptorPool(C_.device, p.pool, 0); p.left = kPoolSets; }
+    sets_.clear();
+}
+
+const GpuBuf* TunedGemm::workspace(VkDeviceSize bytes) {
+    if (ws_.empty() || ws_.back().size < bytes) {
+        GpuBuf w; w.size = bytes;
+        MemArena a;
+        if (VkResult r = try_create_arena(C_, MemPlace::Device, {&w}, &a)) {
+            fprintf(stderr, "vkgemm: %.1f MiB split-K workspace failed (VkResult %d)\n", double(bytes) / (1 << 20), r);
+            return nullptr;
+        }
+        ws_.push_back(w);
+        ws_arenas_.push_back(a);
+    }
+    return &ws_.back();
+}
+
+bool TunedGemm::record(VkCommandBuffer cb, const GemmBufs& b, uint32_t M, uint32_t N, uint32_t K,
+                       uint32_t batch, float alpha, float beta, uint32_t epi) {
+    const size_t i = nearest(M, N, K, batch);
+    if (i == table_.size()) return false;
+    Cand g = table_[i].g;
+    if (b.packedB && !g.packb) { fprintf(stderr, "vkgemm: packed B given for %ux%ux%u, but its entry reads plain B\n", M, N, K); return false; }
+    g.packb = b.packedB ? 1u : 0u;
+    // the caller's epilogue, whatever the entry (or a neighbour) was tuned with
+    g.epi = epi;
+    if ((epi & EPI_BIAS) && !b.bias) { fprintf(stderr, "vkgemm: %s for %ux%ux%u without a bias buffer\n", epilogue_name(epi).c_str(), M, N, K); return false; }
+    VkPipeline pipe = pipeline(g);
+    if (!pipe) return false;
+
+    const std::vector<uint32_t> push = gemm_push(g, M, N, K, batch, alpha, beta);
+    const uint32_t slices = push[7];
+    const VkDescriptorBufferInfo biA{b.A, b.offA, VK_WHOLE_SIZE}, biB{b.B, b.offB, VK_WHOLE_SIZE}, biC{b.C, b.offC, VK_WHOLE_SIZE};
+    // binding 3 must be valid even when the epilogue has no bias; C stands in, never read
+    const VkDescriptorBufferInfo biBias = b.bias ? VkDescriptorBufferInfo{b.bias, b.offBias, VK_WHOLE_SIZE} : biC;
+    auto dispatch = [&](VkPipeline p, VkDescriptorSet set, uint32_t gx, uint32_t gy, uint32_t gz){
+        vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, p);
+        vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE, C_.ppl, 0, 1, &set, 0, nullptr);
+        vkCmdPushConstants(cb, C_.ppl, VK_SHADER_STAGE_COMPUTE_BIT, 0, uint32_t(push.size()*sizeof(uint32_t)), push.data());
+        vkCmdDispatch(cb, gx, gy, gz);
+    };
+    auto barrier = [&](VkAccessFlags src, VkAccessFlags dst){
+        VkMemoryBarrier mb{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+        mb.srcAccessMask = src; mb.dstAccessMask = dst;
+        vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0, 1, &mb, 0, nullptr, 0, nullptr);
+    };
+    if (slices == 1) {
+        VkDescriptorSet direct = descriptor_set({biA, biB, biC, biBias});
+        if (!direct) return false;
+        dispatch(pipe, direct, ceil_div(N, g.TN), ceil_div(M, g.TM), batch);
+        return true;
+    }
+
+    // Split-K: the fused GEMM writes raw partial sums, the reduction applies the epilogue
+    VkPipeline red = reduce_pipeline(g.epi);
+    if (!red) return false;
+    const GpuBuf* W = workspace(VkDeviceSize(4) * slices * batch * M * N);
+    if (!W) return false;
+    const VkDescriptorBufferInfo biW{W->buf, 0, W->size};
+    VkDescriptorSet split = descriptor_set({biA, biB, biW, biBias});
+    VkDescriptorSet reduce = descriptor_set({biW, biB, biC, biBias});
+    if (!split || !reduce) return false;
+    // an earlier split-K GEMM's reduction may still be reading the workspace
+    barrier(VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+    dispatch(pipe, split, ceil_div(N, g.TN), ceil_div(M, g.TM), batch * slices);
+    barrier(VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+    dispatch(red, reduce, ceil_div(N, 64), M, batch);
+    return true;
+}
+
+bool TunedGemm::run(const GemmBufs& b, uint32_t M, uint32_t N, uint32_t K,
+                    uint32_t batch, float alpha, float beta, uint32_t epi) {
+    // submit_once without its exit on error, from this instance's own pool
+    if (!cpool_) {
+        VkCommandPoolCreateInfo pci{VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+        pci.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        pci.queueFamilyIndex = C_.qfam;
+        if (VkResult r = vkCreateCommandPool(C_.device, &pci, nullptr, &cpool_)) {
+            fprintf(stderr, "vkgemm: command pool failed (VkResult %d)\n", r);
+            return false;
+        }
+    }
+    VkCommandBufferAllocateInfo cbai{VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+    cbai.commandPool = cpool_; cbai.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY; cbai.commandBufferCount = 1;
+    VkCommandBuffer cb;
+    if (VkResult r = vkAllocateCommandBuffers(C_.device, &cbai, &cb)) {
+        fprintf(stderr, "vkgemm: command buffer failed (VkResult %d)\n", r);
+        return false;
+    }
+    VkCommandBufferBeginInfo cbi{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    cbi.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VkResult r = vkBeginCommandBuffer(cb, &cbi);
+    bool ok = r == VK_SUCCESS && record(cb, b, M, N, K, batch, alpha, beta, epi);
+    if (ok) {
+        // make C visible to host reads and later submissions
+        VkMemoryBarrier mb{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+        mb.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        mb.dstAccessMask = VK_ACCESS_HOST_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+        vkCmdPipelineBarrier(cb, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             0, 1, &mb, 0, nullptr, 0, nullptr);
+        r = vkEndCommandBuffer(cb);
+    }
+    VkFence fence = VK_NULL_HANDLE;
+    if (ok && !r) {
+        VkFenceCreateInfo fci{VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+        r = vkCreateFence(C_.device, &fci, nullptr, &fence);
+    }
+    if (ok && !r) {
+        VkSubmitInfo si{VK_STRUCTURE_TYPE_SUBMIT_INFO};
+        si.commandBufferCount = 1; si.pCommandBuffers = &cb;
+        r = vkQueueSubmit(C_.queue, 1, &si, fence);
+        if (!r) r = vkWaitForFences(C_.device, 1, &fence, VK_TRUE, UINT64_MAX);
+    }
+    if (ok && r) fprintf(stderr, "vkgemm: submit of %ux%ux%u failed (VkResult %d)\n", M, N, K, r);
+    if (fence) vkDestroyFence(C_.device, fence, nullptr);
+    vkFreeCommandBuffers(C_.device, cpool_, 1, &cb);
+    return ok && r == VK_SUCCESS;
+}
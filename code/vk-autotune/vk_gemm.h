@@ -0,0 +1,183 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 davidscarth
+ */
+#pragma once
+
+// The GEMM kernels (shaders/gemm.comp, gemm_v2.comp, reduce_epilogue.comp) as
+// the tuner measures them, and TunedGemm, which dispatches the winner of a
+// tuned table on an application's own buffers.
+
+#include "vk_common.h"
+
+#include <array>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+// GEMM epilogue (--epilogue=), C = act(alpha*acc + beta*C + bias[col]), as a
+// mask: bits 0-1 activation (EPI_ACT), bit 2 bias (EPI_BIAS), bit 3 alpha/beta
+// with read-modify-write of C (EPI_SCALE). 0 = plain C = acc.
+enum : uint32_t { EPI_RELU = 1, EPI_SILU = 2, EPI_GELU = 3, EPI_ACT_MASK = 3, EPI_BIAS = 4, EPI_SCALE = 8 };
+
+// "scale+bias+silu" -> mask; "none" or "" = 0. False on an unknown word or a
+// second activation.
+bool parse_epilogue(const char* s, uint32_t* epi);
+std::string epilogue_name(uint32_t e);
+
+// fam 0 = shaders/gemm.comp, 1 = shaders/gemm_v2.comp (vec4 loads, double
+// buffering, padded smem rows; vec/dbuf/pad are only used by fam 1).
+// splitk > 1 splits K over that many z workgroups plus a reduction pass.
+// epi is the run's epilogue; fused = 0 compiles the GEMM without it and runs
+// it as a separate elementwise pass.
+// cpu > 0 (percent) leaves the last rows of M to the CPU GEMM (hybrid mode).
+// packb = 1 reads B in the pack_b() layout of its TK x TN tile.
+struct Cand { uint32_t TM,TN,TK, lszx, lszy, smem; uint32_t fam = 0, vec = 1, dbuf = 0, pad = 0, splitk = 1, epi = 0, fused = 1, cpu = 0, packb = 0; };
+
+constexpr uint32_t kFamilies = 2;
+
+// Shared memory footprint: gemm.comp has one unpadded A+B stage, gemm_v2 one
+// or two stages with PAD extra floats per row
+uint32_t smem_bytes(const Cand& g);
+
+// Spec constants: 0->LSX,1->LSY, 2->TM,3->TN,4->TK,5->USE_SMEM,6->SH_ELEMS
+// gemm_v2: 5->VEC, 7->DBUF, 8->PAD, 9->RM, 10->RN
+// both: 11->PACKB
+// epilogue.glsl (both): 16->EPI_ACT, 17->EPI_BIAS, 18->EPI_SCALE, zero unless fused
+// mods[g.fam] is the shader module of the candidate's family.
+// Safe to call from several threads: vkCreateComputePipelines and the cache are
+// internally synchronized.
+VkResult create_pipeline(const VulkanCtx& C, const VkShaderModule* mods, VkPipelineCache cache,
+                         const Cand& g, VkPipeline* pipe);
+
+// reduce_epilogue.comp with epilogue `epi` (0 = plain split-K sum)
+VkResult create_reduce_pipeline(const VulkanCtx& C, VkShaderModule mod, VkPipelineCache cache,
+                                uint32_t epi, VkPipeline* pipe);
+
+inline uint32_t fbits(float f) { uint32_t u; std::memcpy(&u, &f, 4); return u; }
+
+// K per split-K slice: a whole number of TK steps, so only the last slice is ragged
+uint32_t splitk_chunk(const Cand& g, uint32_t K);
+// Slices of K a split-K candidate actually runs (1 without split-K). At 1 the
+// kernel applies the epilogue itself, so it must write C, not the workspace.
+uint32_t splitk_slices(const Cand& g, uint32_t K);
+
+// Packed weights: B[K][N] (row stride ldb) rewritten as ceil(N/TN) column
+// panels, each ceil(K/TK) TK x TN row-major blocks back to back, zero-padded
+// past K and N. A workgroup then loads each B tile as one contiguous run
+// instead of TK strided rows. Constant weights are packed once per layout.
+size_t packed_b_floats(uint32_t K, uint32_t N, uint32_t TK, uint32_t TN);
+void pack_b(const float* B, uint32_t K, uint32_t N, uint32_t ldb, uint32_t TK, uint32_t TN, float* out);
+
+// Push block {M,N,K,lda,ldb,ldc,KS,S,sA,sB,sC,SS,alpha,beta} of `batch` packed
+// row-major GEMMs; with S = splitk_slices() > 1, S slices of KS into a workspace of
+// S x batch x M x N partial sums (SS apart), reduced by reduce_epilogue.comp
+// with the same block. With g.packb, sB is the packed size of one B.
+std::vector<uint32_t> gemm_push(const Cand& g, uint32_t M, uint32_t N, uint32_t K, uint32_t batch,
+                                float alpha, float beta);
+
+// ---------------------------------------------------------------------------
+// Runtime dispatch of a tuned table (the vkgemm library)
+// ---------------------------------------------------------------------------
+// Caller buffers of one GEMM, laid out as in the tuner: A[batch][M][K],
+// B[batch][K][N], C[batch][M][N], row-major and packed. bias[N] is only read
+// with an EPI_BIAS epilogue, and required then. Offsets must be multiples of
+// minStorageBufferOffsetAlignment.
+// packedB: B holds TunedGemm::pack_b() of this shape (entries tuned with
+// packb); otherwise such entries read plain B.
+struct GemmBufs {
+    VkBuffer A = VK_NULL_HANDLE, B = VK_NULL_HANDLE, C = VK_NULL_HANDLE, bias = VK_NULL_HANDLE;
+    VkDeviceSize offA = 0, offB = 0, offC = 0, offBias = 0;
+    bool packedB = false;
+};
+
+// Picks and dispatches the tuned kernel per shape:
+//
+//   VulkanCtx C; try_init_vulkan(C);
+//   TunedGemm gemm(C, "shaders", "gemm.pcache");
+//   gemm.load("winners.tsv");               // autotune --shapes=... --winners=
+//   gemm.run({bufA, bufB, bufC}, M, N, K);  // or record() into a command buffer
+//
+// A shape runs the table entry with the same (M,N,K,batch), else the one
+// closest in log2 of each dimension. Pipelines are created on first use
+// through a VkPipelineCache that is written back on destruction, so after the
+// first run of a service only the table lookup is left. Entries always run
+// entirely on the GPU: a hybrid cpu_split is dropped. The epilogue is the
+// caller's `epi`, fused into the entry's tile; the one an entry was tuned with
+// only shaped its timing. Errors (missing .spv, no memory, exhausted pools)
+// go to stderr and come back as false/0; no TunedGemm member exits the
+// process (the exiting helpers of vk_common.h are the tuner's).
+// An instance is not thread-safe, several on one VulkanCtx are: each has its
+// own pipelines, descriptor and command pools. run() submits to C.queue,
+// though, which Vulkan requires the caller to serialize across threads.
+class TunedGemm {
+public:
+    TunedGemm(VulkanCtx& C, const std::string& shader_dir = "shaders", const std::string& cache_path = "");
+    ~TunedGemm();
+    TunedGemm(const TunedGemm&) = delete;
+    TunedGemm& operator=(const TunedGemm&) = delete;
+
+    // Rows of a --winners TSV, columns found by header name (tables written
+    // before a column existed get its default). Returns the rows added, 0 with
+    // a message on stderr if the file is missing or not a winner table.
+    size_t load(const std::string& path);
+    void add(uint32_t M, uint32_t N, uint32_t K, uint32_t batch, const Cand& g);
+    size_t size() const { return table_.size(); }
+
+    // Table entry used for this shape, null while the table is empty
+    const Cand* pick(uint32_t M, uint32_t N, uint32_t K, uint32_t batch = 1) const;
+
+    // Floats of B packed for this shape's entry, 0 if it reads plain B. Pack
+    // a constant weight matrix once with pack_b() (batch entries K x N apart
+    // in, this size apart out) and pass it with GemmBufs::packedB.
+    size_t packed_b_size(uint32_t M, uint32_t N, uint32_t K, uint32_t batch = 1) const;
+    bool pack_b(const float* B, float* out, uint32_t M, uint32_t N, uint32_t K, uint32_t batch = 1) const;
+
+    // Record C = epilogue(A*B) (and its split-K reduction behind a barrier)
+    // into cb. The caller orders it against its own accesses to the buffers.
+    // epi is an EPI_* mask (0 = plain C = A*B); alpha/beta are only used with
+    // EPI_SCALE. False if no entry fits, its pipeline cannot be created or
+    // EPI_BIAS is asked for without GemmBufs::bias.
+    bool record(VkCommandBuffer cb, const GemmBufs& b, uint32_t M, uint32_t N, uint32_t K,
+                uint32_t batch = 1, float alpha = 1.0f, float beta = 0.0f, uint32_t epi = 0);
+    // record() into a one-off command buffer, submit and wait
+    bool run(const GemmBufs& b, uint32_t M, uint32_t N, uint32_t K,
+             uint32_t batch = 1, float alpha = 1.0f, float beta = 0.0f, uint32_t epi = 0);
+
+    // record() keeps a descriptor set per distinct (buffer, offset) tuple it
+    // was given. Before destroying one of those buffers, once no pending
+    // command buffer uses it, call forget(): a new buffer may get the same
+    // handle and would otherwise be bound through a stale set. reset() drops
+    // every cached set; nothing recorded may be pending then.
+    void forget(VkBuffer buf);
+    void reset();
+
+private:
+    struct Entry { uint32_t M, N, K, batch; Cand g; };
+    size_t nearest(uint32_t M, uint32_t N, uint32_t K, uint32_t batch) const;
+    VkPipeline pipeline(const Cand& g);
+    VkPipeline reduce_pipeline(uint32_t epi);
+    VkDescriptorSet descriptor_set(const std::array<VkDescriptorBufferInfo, 4>& bi);
+    const GpuBuf* workspace(VkDeviceSize bytes);     // null if it cannot be allocated
+
+    VulkanCtx& C_;
+    std::string dir_, cache_path_;
+    VkPipelineCache cache_ = VK_NULL_HANDLE;
+    VkShaderModule mods_[kFamilies] = {};
+    VkShaderModule reduce_mod_ = VK_NULL_HANDLE;
+    std::vector<Entry> table_;
+    std::vector<std::pair<Cand, VkPipeline>> pipes_;        // owned; entries with the same Cand share one
+    std::map<uint32_t, VkPipeline> reduce_;                 // by epilogue mask
+    // One set per distinct (buffer, offset) tuple, from pools of kPoolSets;
+    // sets freed by forget() go back to their pool
+    static constexpr uint32_t kPoolSets = 64;
+    struct Pool { VkDescriptorPool pool; uint32_t left; };
+    struct Set { VkDescriptorSet set; size_t pool; };
+    std::vector<Pool> pools_;
+    std::map<std::array<uint64_t, 8>, Set> sets_;
+    VkCommandPool cpool_ = VK_NULL_HANDLE;                  // run()'s one-off command buffers
+    // Split-K partial sums. A larger one replaces it when needed; old ones may
+    // still be referenced by recorded command buffers and live until the end.
+    std::vector<MemArena> ws_arenas_;
+    std::vector<GpuBuf> ws_;
+};
@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 davidscarth
+ */
+#include "winners.h"
+
+#include <algorithm>
+#include <cmath>
+
+GroupPick best_for(const std::vector<size_t>& set, size_t n_cand, const ShapeTimes& med, const ShapeTimes* est) {
+    GroupPick best{n_cand, INFINITY, 0};
+    std::vector<double> top(set.size());
+    for (size_t i=0; i<set.size(); i++) {
+        top[i] = *std::min_element(med[set[i]].begin(), med[set[i]].end());
+        if (!std::isfinite(top[i])) return best;
+    }
+    for (size_t gi=0; gi<n_cand; gi++) {
+        double score = 0.0;
+        uint32_t n_est = 0;
+        for (size_t i=0; i<set.size(); i++) {
+            double t = med[set[i]][gi];
+            // A probe of a few reps can undercut the winner's full run; pruned
+            // or never run, the candidate is not counted faster than it
+            if (!std::isfinite(t) && est) { t = std::max((*est)[set[i]][gi], top[i]); n_est++; }
+            score += t / top[i];
+        }
+        score /= double(set.size());
+        if (score < best.slowdown) best = GroupPick{gi, score, n_est};
+    }
+    return best;
+}
@@ -0,0 +1,29 @@
+/* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 davidscarth
+ */
+#pragma once
+
+// Picking one candidate for a group of shapes from the per-shape results of a
+// sweep (the s/m/l thirds of the warptile block). No Vulkan here.
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// med[s][gi]: median usec of candidate gi fully measured on shape s, INFINITY
+// if it was not. est[s][gi]: a cheaper estimate where there is no full
+// measurement (the median of its last halving probe, the cost model's
+// prediction), INFINITY if none.
+using ShapeTimes = std::vector<std::vector<double>>;
+
+struct GroupPick {
+    size_t gi;          // n_cand when no candidate covers every shape
+    double slowdown;    // mean of time / the shape's fastest full measurement
+    uint32_t estimated; // shapes where gi was scored by its estimate
+};
+
+// Candidate with the lowest mean slowdown over `set` against each shape's own
+// winner. med counts first; est (if given) fills in where med has no value, so
+// a candidate pruned on one shape of the group can still cover it. A shape
+// without a single full measurement leaves the group uncovered.
+GroupPick best_for(const std::vector<size_t>& set, size_t n_cand, const ShapeTimes& med, const ShapeTimes* est);